@@ -0,0 +1,4 @@
+; loaded by test_core.lsp from inside an expression, the collection asked
+; for here waits until the form that loaded the file is done
+(gc "collect")
+(def {gc-loaded} (list 1 2 3))
@@ -37,68 +37,44 @@
 ; flip arg order for partially evaluated functions
 (fun {flip f a b} {f b a})
 
-; List Length
-(fun {len l} {
-     if (== l nil)
-     	{0}
-     	{+ 1 (len (tail l))}
-})
-
 ; First item in list
 (fun {first l} {eval (head l)})
 
+; The list functions below do their work in the list-* builtins, as Lisp
+; functions they can still be partially applied.
+
+; List Length
+(fun {len l} {list-len l})
+
 ; Nth item in List
-(fun {nth n l} {
-     if (== n 0)
-        {first l}
-        {nth (- n 1) (tail l)}})
+(fun {nth n l} {list-nth n l})
 
 ; Last item in list
-(fun {last l} {nth (- (len l) 1) l})
+(fun {last l} {list-last l})
 
 ; Take first N items
-(fun {take n l} {
-     if (== n 0)
-	     {nil}
-	     {join (head l) (take (- n 1) (tail l))}
-})
+(fun {take n l} {list-take n l})
 
 ; Drop first N items
-(fun {drop n l} {
-     if (== n 0)
-	     {l}
-	     {drop (- n 1) (tail l)}
-})
+(fun {drop n l} {list-drop n l})
 
 ; Split at N
-(fun {split n l} {
-     list (take n l) (drop n l)
-})
+(fun {split n l} {list-split n l})
 
 ; Apply function to list
-(fun {map f l} {
-     if (== l nil)
-     	{nil}
-	{join (list (f (first l))) (map f (tail l))}
-})
+(fun {map f l} {list-map f l})
 
 ; Apply Filter to list
-(fun {filter f l} {
-     if (== l nil)
-     	{nil}
-	{join (if (f (first l)) {head l} {nil}) (filter f (tail l))}
-})
+(fun {filter f l} {list-filter f l})
 
 ; Fold left
-(fun {foldl f z l} {
-     if (== l nil)
-     	{z}
-	{foldl f (f z (first l)) (tail l)}
-})
+(fun {foldl f z l} {list-foldl f z l})
 
 ; Sum
 (fun {sum l} {foldl + 0 l})
 (fun {product l} {foldl * 1 l})
+
+; Fold with logic ops
 (fun {and l} {foldl && true l})
 (fun {or l} {foldl || (head l) l})
 (fun {equal l} {foldl == (head l) l})
@@ -4,10 +4,82 @@
 (assert (tail {tail tail tail}) ({tail tail}))
 (assert (head {head head head}) {head})
 (assert (eval (head {(+ 1 2) (+ 10 20)})) 3)
+; evaluating code leaves it as it was
+(def {code} {+ 1 (* 2 3)})
+(assert (eval code) 7)
+(assert code {+ 1 (* 2 3)})
+(assert (if 1 code {0}) 7)
+(assert code {+ 1 (* 2 3)})
+(assert (eval {}) ())
 ; Charbufs
 (assert (join "header " "body " "tail") "header body tail")
+(def {s} "hello world")
+(assert (str-len s) 11)
+(assert (str-len "") 0)
+(assert (str-byte 0 s) 104)
+(assert (str-slice 6 5 s) "world")
+(assert (str-slice 2 0 s) "")
+(assert (join (str-slice 0 5 s) "!" (str-slice 5 6 s)) "hello! world")
+(assert (str-byte 1 (str-slice 6 5 s)) 111)
+(assert s "hello world")
+(assert_err (str-byte 11 s) "charbuf has 11")
+(assert_err (str-slice 7 5 s) "charbuf has 11")
+(assert_err (str-len 1) "incorrect type")
+; embedded NULs are kept
+(def {z} "a\0b")
+(assert (str-len z) 3)
+(assert (str-byte 1 z) 0)
+(assert (== z "a\0c") 0)
+(assert (str-len (join z z)) 6)
+; large joins make ropes, flattened when their bytes are needed
+(fun {double s n} {if (== n 0) {s} {double (join s s) (- n 1)}})
+(def {k} (double "0123456789abcdef" 6))
+(assert (str-len k) 1024)
+(assert (type k) "Charbuf")
+(assert (str-byte 1000 k) 56)
+(assert (str-slice 1020 4 k) "cdef")
+(assert (join k "\0x") (join (str-slice 0 1024 k) "\0" "x"))
+(fun {grow s n} {if (== n 0) {s} {grow (join s "ab") (- n 1)}})
+(def {g} (grow k 1000))
+(assert (str-len g) 3024)
+(assert (str-slice 1022 6 g) "efabab")
+(assert (str-slice 0 1024 g) k)
+(assert (== (join g "a") (join g "b")) 0)
+; Collector
+; a load inside an expression doesn't collect the values of that expression
+(assert_err gc-loaded "unbound symbol 'gc-loaded'")
+(assert (do (load "lsp/fixtures/gc_collect.lsp") (list 4 5 6)) {4 5 6})
+(assert gc-loaded {1 2 3})
+; values reachable from globals, functions included, survive a collection
+(def {kept} (list 1 "two" {3 (list 4)} (vec {5})))
+(def {add-one} ((\ {a b} {+ a b}) 1))
+(fun {garbage n} {if (== n 0) {0} {do (list n "c" {d}) (garbage (- n 1))}})
+(garbage 10000)
+(gc "collect")
+(assert kept (list 1 "two" {3 (list 4)} (vec {5})))
+(assert (add-one 2) 3)
+(assert (len (gc "stats")) 6)
 ; Function
 (assert ((\ {x y} {+ x y}) 1 10) 11)
+; self tail calls run in constant C stack
+(fun {count-down n} {if (== n 0) {"done"} {count-down (- n 1)}})
+(assert (count-down 1000000) "done")
+; variadic functions with many formals free their scopes by the size they got
+(fun {wide n} {if (== n 0) {0} {do (\ {a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12 a13 a14 a15 a16 a17 a18 a19 a20 a21 a22 a23 a24 a25 a26 a27 a28 a29 a30 a31 a32 & rest} {rest}) (wide (- n 1))}})
+(assert (wide 1000) 0)
+(assert ((\ {a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12 a13 a14 a15 a16 a17 a18 a19 a20 a21 a22 a23 a24 a25 a26 a27 a28 a29 a30 a31 a32 & rest} {rest}) 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31 32 33 34) {33 34})
+; errors name the function by the symbol it was defined as
+(fun {two a b} {+ a b})
+(def {also-two} two)
+(assert_err (two 1 2 3) "Function 'two' passed")
+(assert_err ((two 1) 2 3) "Function 'two' passed")
+(assert_err (also-two 1 2 3) "Function 'two' passed")
+; naming a function doesn't rename other references to it
+(def {anon} (list (\ {a b} {+ a b})))
+(def {three} (eval (head anon)))
+(def {four} (eval (head anon)))
+(assert_err (three 1 2 3) "Function 'three' passed")
+(assert_err (four 1 2 3) "Function 'four' passed")
 (put {x} 1)
 ; Error
 (print "")
@@ -19,6 +91,10 @@
 (assert_err (join "" {}) "Function 'join' passed multiple")
 (assert_err (assert_err (error "test") "testing") "assert failed \"test\" does not contain \"testing\"")
 (assert_err (assert 1 2) "assert failed [1] != [2]")
+(assert_err (error "100%s") "100%s")
+; long messages are not cut short
+(assert_err (error (double "abcdefgh" 8) "end") "hend")
+(assert_err (assert {(double "x" 10)} 1) "10)}] != [1]")
 ; Type
 (assert (type (\ {x y} {+ x y})) "Function")
 (assert (type {head (list 1 2 3 4)}) "Q-expression")
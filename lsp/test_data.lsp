@@ -0,0 +1,27 @@
+; Depends: lib.lsp
+(def {file} "/tmp/lisp_test_data.dat")
+(fun {square x} {* x x})
+(def {values} (list 1 -300 "a\nb\0c" {x {y "z"}} square + (vec {1 -2 3})))
+
+(data-write file 1 -300 "a\nb\0c" {x {y "z"}})
+(data-append file square + (vec {1 -2 3}))
+(assert (data-read file) values)
+(assert ((nth 4 (data-read file)) 7) 49)
+
+; one record at a time, stopping at the first error
+(def {seen} {})
+(data-each file (\ {x} {def {seen} (join seen (list x))}))
+(assert seen values)
+(assert_err (data-each file (\ {x} {error "stop"})) "stop")
+
+(data-write file)
+(assert (data-read file) {})
+(data-append file {1})
+(assert (data-read file) {{1}})
+
+(assert_err (data-read "/nonexistent/lisp.dat") "Unable to open")
+(assert_err (data-read "lsp/test_data.lsp") "not a data file")
+; a function record whose formals are the number 0 and body is {}
+(assert_err (data-read "lsp/bad_fun.dat") "bad function formals")
+(assert_err (data-write 1) "incorrect type")
+(assert_err (data-each file 1) "incorrect type")
@@ -15,3 +15,31 @@
 (lassert (first {1 0 0 0 0}))
 (lassert (last {0 0 0 0 1}))
 (lassert (nth 1 {0 1 0}))
+; partial application
+(assert ((map (\ {x} {* 2 x})) {1 2 3}) {2 4 6})
+(assert ((filter (\ {x} {> x 1})) {1 2 3}) {2 3})
+(assert ((foldl +) 0 {1 2 3}) 6)
+(assert ((nth 1) {1 2 3}) 2)
+(assert ((take 2) {1 2 3}) {1 2})
+(assert ((drop 2) {1 2 3}) {3})
+(assert ((split 1) {1 2 3}) {{1} {2 3}})
+(assert (map (\ {f} {f 10}) (map (\ {x y} {+ x y}) {1 2})) {11 12})
+; bad arguments fail in the builtins
+(assert_err (nth 0 {}) "Function 'list-nth' passed index 0, list has 0 element(s)")
+(assert_err (nth 0 1) "Function 'list-nth' passed incorrect type. Expected Q-expression")
+(assert_err (nth 5 {1 2}) "Function 'list-nth' passed index 5, list has 2 element(s)")
+(assert_err (nth -1 {1 2}) "passed index -1")
+(assert_err (last {}) "Function 'list-last' passed {}")
+(assert_err (len 1) "Function 'list-len' passed incorrect type")
+(assert_err (take 1 2) "Function 'list-take' passed incorrect type")
+(assert_err (take 5 {1 2}) "Function 'list-take' passed 5 element(s), list has 2")
+(assert_err (drop 1 2) "Function 'list-drop' passed incorrect type")
+(assert_err (drop 5 {1 2}) "Function 'list-drop' passed 5 element(s), list has 2")
+(assert_err (split 5 {1 2}) "Function 'list-split' passed 5 element(s), list has 2")
+(assert_err (filter (\ {x} {"a"}) {1 2}) "Function 'list-filter' passed a function returning Charbuf, expected Number")
+(assert_err (filter (\ {x} {error "no"}) {1 2}) "no")
+(assert_err (foldl 1 0 {1}) "Function 'eval_sexpr' passed incorrect type")
+(assert_err (sum {1 "a"}) "Charbuf:(1 a)")
+(assert (product {}) 1)
+(assert (drop 2 {1 2}) {})
+(assert (take 0 {1 2}) {})
@@ -38,6 +38,14 @@ def {x} 1
 (assert (- 1) -1)
 (assert (/ 33 3) 11)
 
+; Overflow
+(assert_err (+ 9223372036854775807 1) "Integer Overflow!")
+(assert_err (- -9223372036854775807 2) "Integer Overflow!")
+(assert_err (- (- -9223372036854775807 1)) "Integer Overflow!")
+(assert_err (* 4611686018427387904 2) "Integer Overflow!")
+(assert_err (/ (- -9223372036854775807 1) -1) "Integer Overflow!")
+(assert (% (- -9223372036854775807 1) -1) 0)
+
 ; Logical
 (assert (&& 1 1) 1)
 (assert (&& 0 1) 0)
@@ -61,6 +69,12 @@ def {x} 1
 (assert (| 5 10) 15)
 (assert (>> 8 1) 4)
 (assert (<< 512 3) 4096)
+(assert (<< 1 63) (- -9223372036854775807 1))
+(assert (<< -1 1) -2)
+(assert (>> -8 1) -4)
+(assert_err (<< 1 64) "Shift Out Of Range!")
+(assert_err (<< 1 70) "Shift Out Of Range!")
+(assert_err (>> 1 -1) "Shift Out Of Range!")
 
 (assert (& 1 1) 1)
 (assert (& 0 1) 0)
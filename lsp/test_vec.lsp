@@ -0,0 +1,44 @@
+; Depends: lib.lsp
+(def {a} (vec {1 2 3 4 5 6 7}))
+(def {b} (vec {7 -6 5 4 3 -2 1}))
+
+(assert (type a) "Vector")
+(assert (vec-len a) 7)
+(assert (vec-list a) {1 2 3 4 5 6 7})
+(assert (vec-list (vec {})) {})
+(assert_err (vec {1 "x"}) "incorrect type")
+(assert_err (vec+ a (vec {1})) "length")
+(assert_err (vec+ 1 2) "incorrect type")
+(assert_err (vec-min (vec {})) "passed []")
+
+; every kernel, the lengths leave elements over for the scalar tail. Each
+; instruction set the CPU has must give the same results.
+(fun {vec-results _} {
+     list (vec+ a b) (vec- a b) (vec* a b) (vec* a 3) (vec- 10 a)
+	  (vec== a b) (vec< a b) (vec> a b)
+	  (vec-sum a) (vec-dot a b) (vec-min b) (vec-max b)
+	  (vec* (vec {4294967296 -3 -4294967297}) (vec {4294967297 -5 3}))
+	  (vec+ (vec {9223372036854775807}) 1)
+})
+
+(def {expected} (list
+     (vec {8 -4 8 8 8 4 8}) (vec {-6 8 -2 0 2 8 6})
+     (vec {7 -12 15 16 15 -12 7}) (vec {3 6 9 12 15 18 21})
+     (vec {9 8 7 6 5 4 3})
+     (vec {0 0 0 1 0 0 0}) (vec {1 0 1 0 0 0 0}) (vec {0 1 0 0 1 1 1})
+     28 36 -6 7
+     (vec {4294967296 15 -12884901891})
+     (vec {-9223372036854775808})))
+
+(vec-isa "scalar")
+(assert (vec-results 0) expected)
+
+; forcing an instruction set the CPU lacks is an error
+(fun {vec-check isa} {
+     if (== (type (vec-isa isa)) "Error")
+	{assert_err (vec-isa isa) "is not supported"}
+	{assert (vec-results 0) expected}
+})
+(vec-check "sse2")
+(vec-check "avx2")
+(assert_err (vec-isa "avx512") "avx512 is not supported")
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lisp.h"
+#include "lalloc.h"
+
+#ifdef LALLOC_MALLOC
+
+void *lalloc(size_t size)
+{
+	if (!size)
+		return NULL;
+	return xmalloc(size);
+}
+
+void lfree(void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+void *lrealloc(void *ptr, size_t old_size, size_t new_size)
+{
+	if (!new_size) {
+		free(ptr);
+		return NULL;
+	}
+	ptr = realloc(ptr, new_size);
+	if (!ptr)
+		die("%s", "failed to allocate memory\n");
+	return ptr;
+}
+
+#else
+
+#define NCLASSES (LALLOC_MAX_SIZE / LALLOC_GRANULE)
+#define SLAB_SIZE (64 * 1024)
+
+/* freed objects are threaded through their first word */
+struct free_obj {
+	struct free_obj *next;
+};
+
+/* slabs are never returned to the system, they are kept on a list so that
+ * the memory stays reachable for leak checkers
+ */
+struct slab {
+	struct slab *next;
+};
+
+struct size_class {
+	struct free_obj *free;
+	char *bump;
+	char *end;
+};
+
+static __thread struct size_class classes[NCLASSES];
+static __thread struct slab *slabs;
+
+static inline int size_to_class(size_t size)
+{
+	return (size + LALLOC_GRANULE - 1) / LALLOC_GRANULE - 1;
+}
+
+/* carve a new slab for class c, the slab header occupies the first granule */
+static void slab_refill(struct size_class *c)
+{
+	struct slab *s = xmalloc(SLAB_SIZE);
+	s->next = slabs;
+	slabs = s;
+	c->bump = (char *)s + LALLOC_GRANULE;
+	c->end = (char *)s + SLAB_SIZE;
+}
+
+void *lalloc(size_t size)
+{
+	if (!size)
+		return NULL;
+	if (size > LALLOC_MAX_SIZE)
+		return xmalloc(size);
+
+	int i = size_to_class(size);
+	struct size_class *c = &classes[i];
+	size_t obj_size = (i + 1) * LALLOC_GRANULE;
+
+	/* reuse a freed object first */
+	if (c->free) {
+		struct free_obj *o = c->free;
+		c->free = o->next;
+		return o;
+	}
+
+	if ((size_t)(c->end - c->bump) < obj_size)
+		slab_refill(c);
+	void *ret = c->bump;
+	c->bump += obj_size;
+	return ret;
+}
+
+void lfree(void *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+	if (size > LALLOC_MAX_SIZE) {
+		free(ptr);
+		return;
+	}
+	struct size_class *c = &classes[size_to_class(size)];
+	struct free_obj *o = ptr;
+	o->next = c->free;
+	c->free = o;
+}
+
+void *lrealloc(void *ptr, size_t old_size, size_t new_size)
+{
+	if (!ptr)
+		return new_size ? lalloc(new_size) : NULL;
+	if (!new_size) {
+		lfree(ptr, old_size);
+		return NULL;
+	}
+
+	/* both sizes map to the same slot size, nothing to do */
+	if (old_size <= LALLOC_MAX_SIZE && new_size <= LALLOC_MAX_SIZE &&
+	    size_to_class(old_size) == size_to_class(new_size))
+		return ptr;
+
+	/* both live on the malloc heap */
+	if (old_size > LALLOC_MAX_SIZE && new_size > LALLOC_MAX_SIZE) {
+		ptr = realloc(ptr, new_size);
+		if (!ptr)
+			die("%s", "failed to allocate memory\n");
+		return ptr;
+	}
+
+	void *ret = lalloc(new_size);
+	memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
+	lfree(ptr, old_size);
+	return ret;
+}
+
+#endif
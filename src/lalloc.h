@@ -0,0 +1,21 @@
+#ifndef _LALLOC_H
+#define _LALLOC_H
+#include <stddef.h>
+
+/* Small object allocator
+ *
+ * Requests up to LALLOC_MAX_SIZE bytes are served from per-thread slabs
+ * split into 16 byte size classes, larger requests go straight to malloc.
+ * The caller passes the size back on free so no header is needed.
+ *
+ * Build with -DLALLOC_MALLOC to route everything through malloc/free, which
+ * keeps ASan/LSan/valgrind reports meaningful.
+ */
+#define LALLOC_GRANULE 16
+#define LALLOC_MAX_SIZE 256
+
+void *lalloc(size_t size);
+void lfree(void *ptr, size_t size);
+void *lrealloc(void *ptr, size_t old_size, size_t new_size);
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdarg.h>
+#include <string.h>
+#include "lisp.h"
+#include "lbuf.h"
+
+/* size of the buffer in front of a FILE */
+#define LBUF_FILE_SIZE 4096
+
+void lbuf_init(struct lbuf *b, FILE *f)
+{
+	b->len = 0;
+	b->cap = f ? LBUF_FILE_SIZE : 64;
+	b->s = xmalloc(b->cap);
+	b->f = f;
+}
+
+/* room for n more bytes and a terminator */
+static void lbuf_reserve(struct lbuf *b, size_t n)
+{
+	if (b->len + n < b->cap)
+		return;
+	if (b->f) {
+		fwrite(b->s, 1, b->len, b->f);
+		b->len = 0;
+		if (n < b->cap)
+			return;
+	}
+	while (b->len + n >= b->cap)
+		b->cap *= 2;
+	b->s = realloc(b->s, b->cap);
+	if (!b->s)
+		die("%s", "failed to allocate memory\n");
+}
+
+void lbuf_put(struct lbuf *b, const char *s, size_t n)
+{
+	lbuf_reserve(b, n);
+	memcpy(b->s + b->len, s, n);
+	b->len += n;
+}
+
+void lbuf_puts(struct lbuf *b, const char *s)
+{
+	lbuf_put(b, s, strlen(s));
+}
+
+void lbuf_putc(struct lbuf *b, char c)
+{
+	lbuf_reserve(b, 1);
+	b->s[b->len++] = c;
+}
+
+void lbuf_vprintf(struct lbuf *b, const char *fmt, va_list va)
+{
+	va_list again;
+	int n;
+
+	va_copy(again, va);
+	n = vsnprintf(b->s + b->len, b->cap - b->len, fmt, va);
+	if (n >= 0 && (size_t)n >= b->cap - b->len) {
+		lbuf_reserve(b, n);
+		vsnprintf(b->s + b->len, b->cap - b->len, fmt, again);
+	}
+	va_end(again);
+	if (n > 0)
+		b->len += n;
+}
+
+void lbuf_printf(struct lbuf *b, const char *fmt, ...)
+{
+	va_list va;
+	va_start(va, fmt);
+	lbuf_vprintf(b, fmt, va);
+	va_end(va);
+}
+
+void lbuf_flush(struct lbuf *b)
+{
+	if (b->f)
+		fwrite(b->s, 1, b->len, b->f);
+	free(b->s);
+	b->s = NULL;
+	b->len = b->cap = 0;
+}
+
+char *lbuf_take(struct lbuf *b)
+{
+	char *s = b->s;
+	s[b->len] = '\0';
+	b->s = NULL;
+	b->len = b->cap = 0;
+	return s;
+}
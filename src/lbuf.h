@@ -0,0 +1,33 @@
+#ifndef _LBUF_H
+#define _LBUF_H
+#include <stdarg.h>
+#include <stdio.h>
+#include <stddef.h>
+
+/* Growable output buffer
+ *
+ * Appending is amortized O(1). A buffer made with a FILE * writes its
+ * contents there whenever it fills up instead of growing, so printing a
+ * value of any size needs only a fixed amount of memory.
+ */
+struct lbuf {
+	char *s;
+	size_t len;
+	size_t cap;
+	FILE *f; /* NULL to build a string */
+};
+
+void lbuf_init(struct lbuf *b, FILE *f);
+void lbuf_put(struct lbuf *b, const char *s, size_t n);
+void lbuf_puts(struct lbuf *b, const char *s);
+void lbuf_putc(struct lbuf *b, char c);
+void lbuf_printf(struct lbuf *b, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void lbuf_vprintf(struct lbuf *b, const char *fmt, va_list va);
+
+/* write out what is buffered and free the buffer */
+void lbuf_flush(struct lbuf *b);
+/* the NUL terminated string built so far, the caller frees it */
+char *lbuf_take(struct lbuf *b);
+
+#endif
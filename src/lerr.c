@@ -2,35 +2,25 @@
 #include <stdlib.h>
 #include "lisp.h"
 #include "lerr.h"
-
-static char *fmt(const char *fmt, ...)
-{
-	const int size = 512;
-	va_list va;
-	va_start(va, fmt);
-	void *buf = xmalloc(size);
-	vsnprintf(buf, size, fmt, va);
-	va_end(va);
-	return buf;
-}
+#include "lgc.h"
+#include "lbuf.h"
 
 struct lval *lval_func_err(struct lval *a, const char *fname,
 			   const char *message, ...)
 {
-	const char format[] = "Function '%s' %s";
-	const int size = 512;
-
+	struct lbuf b;
 	va_list va;
 	va_start(va, message);
-	char *concat = fmt(format, fname, message);
 
-	struct lval *v = xmalloc(sizeof(struct lval));
+	struct lval *v = lgc_alloc();
 	v->type = LVAL_ERR;
+	v->refs = 1;
 
-	v->err = xmalloc(size);
-	vsnprintf(v->err, size, concat, va);
+	lbuf_init(&b, NULL);
+	lbuf_printf(&b, "Function '%s' ", fname);
+	lbuf_vprintf(&b, message, va);
+	v->err = lbuf_take(&b);
 	va_end(va);
-	free(concat);
 	return v;
 }
 
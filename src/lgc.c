@@ -0,0 +1,214 @@
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "lisp.h"
+#include "lgc.h"
+
+static struct lgc_stats stats;
+static long threshold;
+static long allocated; /* bytes since the last collection */
+static int requested;
+
+void lgc_set_threshold(long bytes)
+{
+	threshold = bytes;
+}
+
+void lgc_request(void)
+{
+	requested = 1;
+}
+
+int lgc_due(void)
+{
+	return requested || (threshold && allocated >= threshold);
+}
+
+struct lgc_stats *lgc_stats(void)
+{
+	return &stats;
+}
+
+#ifdef LALLOC_MALLOC
+
+struct lval *lgc_alloc(void)
+{
+	return xmalloc(sizeof(struct lval));
+}
+
+void lgc_free(struct lval *v)
+{
+	free(v);
+}
+
+void lgc_collect(struct lenv *e, struct lval *root)
+{
+	requested = 0;
+	allocated = 0;
+}
+
+void lgc_cleanup(void)
+{
+}
+
+#else
+
+/* Chunks are aligned to their size so the chunk of an lval is found by
+ * masking its address. Free slots have refs == 0 and are threaded through
+ * their cell pointer, slots past used were never handed out.
+ */
+#define CHUNK_SIZE (64 * 1024)
+#define CHUNK_LVALS                                                            \
+	((CHUNK_SIZE - 2 * sizeof(void *)) / (sizeof(struct lval) + 1))
+
+struct lchunk {
+	struct lchunk *next;
+	long used;
+	unsigned char mark[CHUNK_LVALS];
+	struct lval vals[CHUNK_LVALS];
+};
+_Static_assert(sizeof(struct lchunk) <= CHUNK_SIZE,
+	       "a chunk must fit the aligned block it is allocated in");
+
+static struct lchunk *chunks;
+static struct lval *free_list;
+
+/* marked lvals whose children still need marking */
+static struct lval **gray;
+static long gray_count;
+static long gray_cap;
+
+static inline struct lchunk *lgc_chunk(struct lval *v)
+{
+	return (struct lchunk *)((uintptr_t)v & ~(uintptr_t)(CHUNK_SIZE - 1));
+}
+
+static inline unsigned char *lgc_mark_bit(struct lval *v)
+{
+	struct lchunk *c = lgc_chunk(v);
+	return &c->mark[v - c->vals];
+}
+
+struct lval *lgc_alloc(void)
+{
+	struct lval *v;
+
+	allocated += sizeof(struct lval);
+	if (free_list) {
+		v = free_list;
+		free_list = (struct lval *)v->cell;
+		return v;
+	}
+	if (!chunks || chunks->used == CHUNK_LVALS) {
+		struct lchunk *c;
+		if (posix_memalign((void **)&c, CHUNK_SIZE, sizeof(*c)))
+			die("%s", "failed to allocate memory\n");
+		c->next = chunks;
+		c->used = 0;
+		memset(c->mark, 0, sizeof(c->mark));
+		chunks = c;
+		stats.heap_bytes += CHUNK_SIZE;
+	}
+	return &chunks->vals[chunks->used++];
+}
+
+void lgc_free(struct lval *v)
+{
+	v->refs = 0;
+	v->cell = (struct lval **)free_list;
+	free_list = v;
+}
+
+static void lgc_mark(struct lval *v)
+{
+	if (lval_is_fixnum(v))
+		return;
+	unsigned char *m = lgc_mark_bit(v);
+	if (*m)
+		return;
+	*m = 1;
+	if (gray_count == gray_cap) {
+		gray_cap = gray_cap ? gray_cap * 2 : 1024;
+		gray = realloc(gray, sizeof(struct lval *) * gray_cap);
+		if (!gray)
+			die("%s", "failed to allocate memory\n");
+	}
+	gray[gray_count++] = v;
+}
+
+/* garbage pointing at a live lval holds one of its references */
+static void lgc_unref_live(struct lval *v)
+{
+	if (!lval_is_fixnum(v) && *lgc_mark_bit(v))
+		v->refs--;
+}
+
+static long lgc_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void lgc_collect(struct lenv *e, struct lval *root)
+{
+	struct lchunk *c;
+	long i, live = 0, garbage = 0;
+	long start = lgc_now_us();
+
+	/* mark */
+	lenv_children(e, lgc_mark);
+	if (root)
+		lgc_mark(root);
+	while (gray_count)
+		lval_children(gray[--gray_count], lgc_mark);
+
+	/* drop the references garbage holds on live lvals first, the
+	 * garbage itself is freed without looking at its children
+	 */
+	for (c = chunks; c; c = c->next)
+		for (i = 0; i < c->used; i++)
+			if (c->vals[i].refs && !c->mark[i])
+				lval_children(&c->vals[i], lgc_unref_live);
+
+	for (c = chunks; c; c = c->next) {
+		for (i = 0; i < c->used; i++) {
+			if (!c->vals[i].refs)
+				continue;
+			if (c->mark[i]) {
+				c->mark[i] = 0;
+				live++;
+				continue;
+			}
+			lval_free_shallow(&c->vals[i]);
+			lgc_free(&c->vals[i]);
+			garbage++;
+		}
+	}
+
+	long pause = lgc_now_us() - start;
+	stats.collections++;
+	stats.pause_us += pause;
+	if (pause > stats.max_pause_us)
+		stats.max_pause_us = pause;
+	stats.freed_bytes += garbage * sizeof(struct lval);
+	stats.live_bytes = live * sizeof(struct lval);
+	requested = 0;
+	allocated = 0;
+}
+
+void lgc_cleanup(void)
+{
+	while (chunks) {
+		struct lchunk *c = chunks;
+		chunks = c->next;
+		free(c);
+	}
+	free_list = NULL;
+	free(gray);
+	gray = NULL;
+	gray_cap = 0;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _LGC_H
+#define _LGC_H
+
+/* Backup mark and sweep collector for lvals
+ *
+ * Reference counting frees almost everything as soon as it becomes
+ * unreachable. The collector finds what it misses (reference cycles, leaked
+ * references) by marking from the global environment and the expression
+ * being loaded, then sweeping the lval heap. It only runs at safe points
+ * between top level forms, where no C code holds an lval.
+ *
+ * lvals live in their own chunks so the heap can be walked. Build with
+ * -DLALLOC_MALLOC to use malloc instead, the collector is disabled then.
+ */
+struct lgc_stats {
+	long collections;
+	long pause_us;     /* total */
+	long max_pause_us;
+	long freed_bytes;
+	long heap_bytes;
+	long live_bytes;
+};
+
+struct lval *lgc_alloc(void);
+void lgc_free(struct lval *v);
+
+/* collect at safe points once this many bytes of lvals were allocated
+ * since the last collection, 0 disables automatic collection
+ */
+void lgc_set_threshold(long bytes);
+void lgc_request(void);
+int lgc_due(void);
+void lgc_collect(struct lenv *e, struct lval *root);
+struct lgc_stats *lgc_stats(void);
+void lgc_cleanup(void);
+
+#endif
@@ -3,24 +3,33 @@
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <editline/readline.h>
 #include <editline/history.h>
 
-#include "../mpc/mpc.h"
 #include "lisp.h"
 #include "lerr.h"
+#include "lalloc.h"
+#include "lbuf.h"
+#include "lsym.h"
+#include "lvm.h"
+#include "lgc.h"
+#include "lvec.h"
+#include "lser.h"
 
-static char *lval_expr_to_str(struct lenv *, struct lval *, char open,
-			      char close);
 static char *lenv_lookup_sym_by_val(struct lenv *e, struct lval *a);
+static const char *lval_fun_name(struct lenv *e, struct lval *f);
 static int lenv_get_sym_pos(struct lenv *, char *);
-static struct lval *lenv_get(struct lenv *, struct lval *);
-static struct lval *lval_num(long x);
-static struct lval *lval_sexpr(void);
-static struct lval *lval_add(struct lval *v, struct lval *x);
+struct lval *lenv_get(struct lenv *, struct lval *);
+struct lval *lval_sexpr(void);
 static struct lval *lval_eval(struct lenv *, struct lval *);
 static struct lval *lval_copy(struct lval *v);
+struct lval *lval_ref(struct lval *v);
+static struct lval *lval_cow(struct lval *v);
 static struct lval *lval_take(struct lval *, int i);
 static struct lval *lval_pop(struct lval *, int i);
 static struct lval *lval_call(struct lenv *, struct lval *, struct lval *);
@@ -34,16 +43,50 @@ static struct lval *builtin_assert(struct lenv *, struct lval *);
 static struct lval *builtin_assert_err(struct lenv *e, struct lval *a);
 
 static struct lval *builtin_load(struct lenv *, struct lval *);
+static struct lval *builtin_data_write(struct lenv *, struct lval *);
+static struct lval *builtin_data_append(struct lenv *, struct lval *);
+static struct lval *builtin_data_read(struct lenv *, struct lval *);
+static struct lval *builtin_data_each(struct lenv *, struct lval *);
 
 static struct lval *builtin_type(struct lenv *, struct lval *);
+static struct lval *builtin_gc(struct lenv *, struct lval *);
 
-static struct lval *builtin_op(struct lenv *, struct lval *, char *, char *);
 static struct lval *builtin_eval(struct lenv *, struct lval *);
+static struct lval *lval_unquote(struct lenv *, struct lval *);
+static struct lval *lval_if_branch(struct lenv *, struct lval *);
 
 static struct lval *builtin_join(struct lenv *, struct lval *);
 static struct lval *builtin_list(struct lenv *, struct lval *);
 static struct lval *builtin_head(struct lenv *, struct lval *);
 static struct lval *builtin_tail(struct lenv *, struct lval *);
+static struct lval *builtin_list_len(struct lenv *, struct lval *);
+static struct lval *builtin_list_nth(struct lenv *, struct lval *);
+static struct lval *builtin_list_last(struct lenv *, struct lval *);
+static struct lval *builtin_list_take(struct lenv *, struct lval *);
+static struct lval *builtin_list_drop(struct lenv *, struct lval *);
+static struct lval *builtin_list_split(struct lenv *, struct lval *);
+static struct lval *builtin_list_map(struct lenv *, struct lval *);
+static struct lval *builtin_list_filter(struct lenv *, struct lval *);
+static struct lval *builtin_list_foldl(struct lenv *, struct lval *);
+
+static struct lval *builtin_vec(struct lenv *, struct lval *);
+static struct lval *builtin_vec_list(struct lenv *, struct lval *);
+static struct lval *builtin_vec_len(struct lenv *, struct lval *);
+static struct lval *builtin_vec_add(struct lenv *, struct lval *);
+static struct lval *builtin_vec_sub(struct lenv *, struct lval *);
+static struct lval *builtin_vec_mul(struct lenv *, struct lval *);
+static struct lval *builtin_vec_eq(struct lenv *, struct lval *);
+static struct lval *builtin_vec_gt(struct lenv *, struct lval *);
+static struct lval *builtin_vec_lt(struct lenv *, struct lval *);
+static struct lval *builtin_vec_sum(struct lenv *, struct lval *);
+static struct lval *builtin_vec_min(struct lenv *, struct lval *);
+static struct lval *builtin_vec_max(struct lenv *, struct lval *);
+static struct lval *builtin_vec_dot(struct lenv *, struct lval *);
+static struct lval *builtin_vec_isa(struct lenv *, struct lval *);
+
+static struct lval *builtin_str_len(struct lenv *, struct lval *);
+static struct lval *builtin_str_byte(struct lenv *, struct lval *);
+static struct lval *builtin_str_slice(struct lenv *, struct lval *);
 
 static struct lval *builtin_add(struct lenv *, struct lval *);
 static struct lval *builtin_sub(struct lenv *, struct lval *);
@@ -56,7 +99,6 @@ static struct lval *builtin_var(struct lenv *, struct lval *, char *);
 static struct lval *builtin_lambda(struct lenv *, struct lval *);
 static struct lval *builtin_put(struct lenv *, struct lval *);
 
-static struct lval *builtin_order(struct lenv *, struct lval *, char *);
 static struct lval *builtin_eq(struct lenv *e, struct lval *a);
 static struct lval *builtin_ne(struct lenv *e, struct lval *a);
 static struct lval *builtin_le(struct lenv *e, struct lval *a);
@@ -64,7 +106,7 @@ static struct lval *builtin_lt(struct lenv *e, struct lval *a);
 static struct lval *builtin_ge(struct lenv *e, struct lval *a);
 static struct lval *builtin_gt(struct lenv *e, struct lval *a);
 
-static struct lval *builtin_if(struct lenv *e, struct lval *a);
+struct lval *builtin_if(struct lenv *e, struct lval *a);
 
 static struct lval *builtin_or(struct lenv *e, struct lval *a);
 static struct lval *builtin_and(struct lenv *e, struct lval *a);
@@ -79,21 +121,13 @@ static struct lval *builtin_bitwise_xor(struct lenv *e, struct lval *a);
 
 static int lval_eq(struct lval *, struct lval *);
 struct lval *lval_func_err(struct lval *, const char *, const char *, ...);
-static struct lenv *lenv_new(void);
-static struct lval *lenv_get(struct lenv *, struct lval *);
+struct lval *lenv_get(struct lenv *, struct lval *);
 static struct lenv *lenv_copy(struct lenv *e);
-static void lenv_put(struct lenv *e, struct lval *k, struct lval *v);
-static void lenv_free(struct lenv *e);
+static void lenv_free_shallow(struct lenv *e);
 
 static char *version = "Lisp Version 0.0.0.0.1";
-static mpc_parser_t *Number;
-static mpc_parser_t *Symbol;
-static mpc_parser_t *Charbuf;
-static mpc_parser_t *Comment;
-static mpc_parser_t *Qexpr;
-static mpc_parser_t *Sexpr;
-static mpc_parser_t *Expr;
-static mpc_parser_t *Lisp;
+
+int engine = ENGINE_TREE;
 
 #ifdef __clang__
 #define dump(arg) __builtin_dump_struct(arg, &printf);
@@ -117,1305 +151,3323 @@ void print_trace()
 }
 
 /* lval constructors */
-static struct lval *lval_num(long x)
+struct lval *lval_num(long x)
 {
-	struct lval *v = xmalloc(sizeof(struct lval));
+	if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX)
+		return lval_fixnum(x);
+
+	struct lval *v = lgc_alloc();
 	v->type = LVAL_NUM;
+	v->refs = 1;
 	v->num = x;
 	return v;
 }
 
-static struct lval *lval_call(struct lenv *e, struct lval *f, struct lval *a)
-{
-	if (f->type == LVAL_FUN_BUILTIN)
-		return f->builtin(e, a);
-	const char *fname = lenv_lookup_sym_by_val(e, f);
+/* n cells of v from i on as a Q-expression
+ *
+ * The result is a view sharing the cells of v, no copy is made. Views are
+ * never modified in place, lval_cow() turns them into plain lists.
+ */
+static struct lval *lval_slice(struct lval *v, int i, int n)
+{
+	if (n == 0)
+		return lval_qexpr();
+	if (i == 0 && n == v->count && ltype(v) == LVAL_QEXPR)
+		return lval_ref(v);
+
+	struct lval *x = lgc_alloc();
+	x->type = LVAL_QEXPR;
+	x->refs = 1;
+	x->count = n;
+	x->cell = v->cell + i;
+	x->code = NULL;
+	x->cap = -1;
+	x->base = lval_ref(lval_is_view(v) ? v->base : v);
+	return x;
+}
 
-	while (a->count) {
-		if (f->formals->count == 0) {
+/* Bind the argument list a to the formals of the user function f
+ *
+ * The arguments go into a fresh frame, f and the environment it captured
+ * are shared and left untouched. a is consumed, f is not.
+ *
+ * Returns an error, a partial function holding the frame if formals are
+ * left, or the call ready to have its body evaluated: a function whose env
+ * is the frame and whose formals are NULL. The ready call never escapes the
+ * evaluator.
+ */
+struct lval *lval_bind(struct lenv *e, struct lval *f, struct lval *a)
+{
+	struct lval *formals = f->formals;
+	struct lval *out;
+	struct lenv *frame;
+	int i = 0; /* next formal */
+	int j;
+
+	/* more arguments than formals, unless a '&' takes the rest */
+	if (a->count > formals->count) {
+		for (j = 0; j < formals->count; j++)
+			if (strcmp(formals->cell[j]->sym, "&") == 0)
+				break;
+		if (j == formals->count) {
 			lval_free(a);
-			return lerr_args_too_few_variable(f->formals, fname, 1);
+			return lerr_args_too_few_variable(formals,
+							  lval_fun_name(e, f), 1);
 		}
+	}
 
-		/* pop first symbol from formals list */
-		struct lval *sym = lval_pop(f->formals, 0);
+	/* arguments bound by earlier partial applications are kept */
+	frame = lenv_copy(f->env);
+
+	for (j = 0; j < a->count; j++, i++) {
+		struct lval *sym = formals->cell[i];
 
 		/* add support for variable arguments via '&' symbol*/
 		if (strcmp(sym->sym, "&") == 0) {
-			if (f->formals->count != 1) {
-				lval_free(a);
-				char *str = lval_to_str(e, a);
-				struct lval *out = lval_func_err(
-					f->formals, fname,
+			if (formals->count - i - 1 != 1) {
+				const char *fname = lval_fun_name(e, f);
+				struct lval *rest = lval_slice(a, j, a->count - j);
+				rest->type = LVAL_SEXPR;
+				char *str = lval_to_str(e, rest);
+				lval_free(rest);
+				out = lval_func_err(
+					formals, fname,
 					"& must be followed by one symbol, "
 					" in %s received %d: %s",
-					fname, f->formals->count, str);
+					fname, formals->count - i - 1, str);
 				free(str);
-				lval_free(sym);
+				lval_free(a);
+				lenv_free(frame);
 				return out;
 			}
 
 			/* Bind variable formal to remaining args */
-			struct lval *nsym = lval_pop(f->formals, 0);
-			lenv_put(f->env, nsym, builtin_list(e, a));
-			lval_free(sym);
-			lval_free(nsym);
+			struct lval *rest = lval_slice(a, j, a->count - j);
+			lenv_put(frame, formals->cell[i + 1], rest);
+			lval_free(rest);
+			i = formals->count;
 			break;
 		}
 
-		/* pop first arg from list */
-		struct lval *val = lval_pop(a, 0);
-
-		/* Bind a copy into the function's environment */
-		lenv_put(f->env, sym, val);
-
-		/* Delete symbol and value */
-		lval_free(sym);
-		lval_free(val);
+		/* Bind a reference into the frame */
+		lenv_put(frame, sym, a->cell[j]);
 	}
 
 	/* arg list is bound, clean up */
 	lval_free(a);
 
-	if (f->formals->count == 0) {
-		/* set environment parent to evaluation environment */
-		f->env->par = e;
-
-		/* evaluate and return */
-		return builtin_eval(f->env,
-				    lval_add(lval_sexpr(), lval_copy(f->body)));
-	} else {
-		/* return a partial */
-		return lval_copy(f);
-	}
+	out = lgc_alloc();
+	out->type = LVAL_FUN;
+	out->refs = 1;
+	out->env = frame;
+	out->body = lval_ref(f->body);
+	out->formals = i < formals->count ? lval_slice(formals, i, formals->count - i) :
+					  NULL;
+	out->name = f->name;
+	return out;
 }
 
 static struct lval *lval_err(const char *fmt, ...)
 {
-	const int size = 512;
+	struct lbuf b;
 	va_list va;
 	va_start(va, fmt);
 
-	struct lval *v = xmalloc(sizeof(struct lval));
+	struct lval *v = lgc_alloc();
 	v->type = LVAL_ERR;
+	v->refs = 1;
 
-	v->err = xmalloc(size);
-	vsnprintf(v->err, size, fmt, va);
+	lbuf_init(&b, NULL);
+	lbuf_vprintf(&b, fmt, va);
+	v->err = lbuf_take(&b);
 	va_end(va);
 	return v;
 }
 
+/* symbol named by the n characters at s */
+struct lval *lval_sym_n(const char *s, size_t n)
+{
+	struct lval *v = lgc_alloc();
+	v->type = LVAL_SYM;
+	v->refs = 1;
+	v->sym = lsym_intern_n(s, n);
+	v->scope = NULL;
+	v->depth = 0;
+	v->slot = 0;
+	return v;
+}
+
 static struct lval *lval_sym(char *s)
 {
-	struct lval *v = xmalloc(sizeof(struct lval));
+	struct lval *v = lgc_alloc();
 	v->type = LVAL_SYM;
-	v->sym = xmalloc(strlen(s) + 1);
-	strcpy(v->sym, s);
+	v->refs = 1;
+	v->sym = lsym_intern(s);
+	v->scope = NULL;
+	v->depth = 0;
+	v->slot = 0;
 	return v;
 }
 
-/* TODO: use strncpy() here instead */
-static struct lval *lval_read_str(mpc_ast_t *t)
+/* charbuf owning buf, which holds len bytes, a NUL and has room for cap */
+static struct lval *lval_str_own(char *buf, long len, long cap)
 {
-	t->contents[strlen(t->contents) - 1] = '\0';
-	char *buf = xmalloc(strlen(t->contents + 1) + 1);
-	char *unescaped;
-	strcpy(buf, t->contents + 1);
+	struct lval *v = lgc_alloc();
+	v->type = LVAL_CHARBUF;
+	v->refs = 1;
+	v->charbuf = buf;
+	v->charbuf_len = len;
+	v->charbuf_cap = cap;
+	v->charbuf_base = NULL;
+	return v;
+}
 
-	/* pass through the unescape function */
-	unescaped = mpcf_unescape(buf);
-	struct lval *out = lval_str(unescaped);
-	free(unescaped);
-	return out;
+/* charbuf holding a copy of the n bytes at s */
+static struct lval *lval_str_n(const char *s, long n)
+{
+	char *buf = xmalloc(n + 1);
+	memcpy(buf, s, n);
+	buf[n] = '\0';
+	return lval_str_own(buf, n, n + 1);
 }
 
 static struct lval *lval_str(char *s)
 {
-	struct lval *v = xmalloc(sizeof(struct lval));
+	return lval_str_n(s, strlen(s));
+}
+
+/* Ropes
+ *
+ * Joining large charbufs makes a rope, a node referring to the two joined
+ * charbufs, instead of copying their bytes. The bytes are copied once, into
+ * a flat buffer that replaces the node's children, when something needs
+ * them in one piece. Ropes deeper than LROPE_DEPTH are flattened as they are
+ * made, so freeing or copying one never recurses far.
+ */
+#define LROPE_MIN 512
+#define LROPE_DEPTH 512
+
+static long lrope_depth(const struct lval *v)
+{
+	return lval_is_rope(v) ? -1 - v->charbuf_cap : 0;
+}
+
+/* copy the bytes of the charbuf v to out, looping down the left side since
+ * joins in order make ropes that grow to the left
+ */
+static void lrope_copy(const struct lval *v, char *out)
+{
+	while (lval_is_rope(v)) {
+		lrope_copy(v->rope_right, out + v->rope_left->charbuf_len);
+		v = v->rope_left;
+	}
+	memcpy(out, v->charbuf, v->charbuf_len);
+}
+
+char *lval_str_bytes(struct lval *v)
+{
+	struct lval *left, *right;
+	long cap;
+
+	if (!lval_is_rope(v))
+		return v->charbuf;
+	left = v->rope_left;
+	right = v->rope_right;
+	for (cap = 16; cap < v->charbuf_len + 1; cap *= 2)
+		;
+	v->charbuf = xmalloc(cap);
+	lrope_copy(left, v->charbuf);
+	lrope_copy(right, v->charbuf + left->charbuf_len);
+	v->charbuf[v->charbuf_len] = '\0';
+	v->charbuf_cap = cap;
+	v->charbuf_base = NULL;
+	lval_free(left);
+	lval_free(right);
+	return v->charbuf;
+}
+
+/* charbuf of the bytes of x followed by those of y, x and y are consumed */
+static struct lval *lval_rope(struct lval *x, struct lval *y)
+{
+	struct lval *v = lgc_alloc();
+	long depth = 1 + lrope_depth(x);
+
 	v->type = LVAL_CHARBUF;
-	v->charbuf = xmalloc(strlen(s) + 1);
-	strcpy(v->charbuf, s);
+	v->refs = 1;
+	v->rope_left = x;
+	v->rope_right = y;
+	v->charbuf_len = x->charbuf_len + y->charbuf_len;
+	if (depth < 1 + lrope_depth(y))
+		depth = 1 + lrope_depth(y);
+	v->charbuf_cap = -1 - depth;
+	if (depth > LROPE_DEPTH)
+		lval_str_bytes(v);
 	return v;
 }
 
-static struct lval *lval_sexpr(void)
+/* n bytes of the charbuf v from start, sharing them with v */
+static struct lval *lval_str_view(struct lval *v, long start, long n)
+{
+	struct lval *x = lgc_alloc();
+	x->type = LVAL_CHARBUF;
+	x->refs = 1;
+	x->charbuf = lval_str_bytes(v) + start;
+	x->charbuf_len = n;
+	x->charbuf_cap = -1;
+	x->charbuf_base =
+		lval_ref(lval_is_str_view(v) ? v->charbuf_base : v);
+	return x;
+}
+
+/* The charbuf v as a C string, a view gets its own copy of its bytes first
+ * since they aren't followed by a NUL. Bytes after an embedded NUL are not
+ * seen by C.
+ */
+static char *lval_cstr(struct lval *v)
+{
+	struct lval *base;
+	char *buf;
+
+	if (!lval_is_str_view(v))
+		return lval_str_bytes(v);
+	base = v->charbuf_base;
+	buf = xmalloc(v->charbuf_len + 1);
+	memcpy(buf, v->charbuf, v->charbuf_len);
+	buf[v->charbuf_len] = '\0';
+	v->charbuf = buf;
+	v->charbuf_cap = v->charbuf_len + 1;
+	v->charbuf_base = NULL;
+	lval_free(base);
+	return buf;
+}
+
+struct lval *lval_sexpr(void)
 {
-	struct lval *v = xmalloc(sizeof(struct lval));
+	struct lval *v = lgc_alloc();
 	v->type = LVAL_SEXPR;
+	v->refs = 1;
 	v->count = 0;
 	v->cell = NULL;
+	v->code = NULL;
+	v->cap = 0;
+	v->off = 0;
 	return v;
 }
 
-static struct lval *lval_qexpr(void)
+struct lval *lval_qexpr(void)
 {
-	struct lval *v = xmalloc(sizeof(struct lval));
+	struct lval *v = lgc_alloc();
 	v->type = LVAL_QEXPR;
+	v->refs = 1;
 	v->count = 0;
 	v->cell = NULL;
+	v->code = NULL;
+	v->cap = 0;
+	v->off = 0;
+	return v;
+}
+
+/* vector of n numbers, left uninitialized */
+struct lval *lval_vec(long n)
+{
+	struct lval *v = lgc_alloc();
+	v->type = LVAL_VEC;
+	v->refs = 1;
+	v->vec = lalloc(sizeof(int64_t) * n);
+	v->vec_len = n;
 	return v;
 }
 
-static struct lval *lval_builtin(lbuiltin func)
+struct lval *lval_builtin(lbuiltin func)
 {
-	struct lval *v = xmalloc(sizeof(struct lval));
+	struct lval *v = lgc_alloc();
 	v->type = LVAL_FUN_BUILTIN;
+	v->refs = 1;
 	v->builtin = func;
 	return v;
 }
 
-static struct lval *lval_lambda(struct lval *formals, struct lval *body)
+static struct lval *lval_lambda(struct lval *formals, struct lval *body,
+				struct lscope *scope)
 {
-	struct lval *v = xmalloc(sizeof(struct lval));
+	struct lval *v = lgc_alloc();
 	v->type = LVAL_FUN;
+	v->refs = 1;
 
-	v->env = lenv_new();
+	v->env = lenv_new_frame(scope);
 	v->formals = formals;
 	v->body = body;
+	v->name = NULL;
 	return v;
 }
 
 void lval_free(struct lval *v)
 {
 	int i;
-	switch (v->type) {
+
+	/* immediate or still shared */
+	if (lval_is_fixnum(v) || --v->refs)
+		return;
+
+	switch (ltype(v)) {
 	case LVAL_ERR:
 		free(v->err);
 		break;
-	case LVAL_SYM:
-		free(v->sym);
+	case LVAL_SYM: /* interned */
+		if (v->scope)
+			lscope_free(v->scope);
 		break;
 	case LVAL_CHARBUF:
-		free(v->charbuf);
+		if (lval_is_rope(v)) {
+			lval_free(v->rope_left);
+			lval_free(v->rope_right);
+		} else if (lval_is_str_view(v)) {
+			lval_free(v->charbuf_base);
+		} else {
+			free(v->charbuf);
+		}
 		break;
 	case LVAL_SEXPR: /* fall through */
 	case LVAL_QEXPR:
-		for (i = 0; i < v->count; i++)
-			lval_free(v->cell[i]);
-		free(v->cell);
+		if (lval_is_view(v)) {
+			lval_free(v->base);
+		} else {
+			for (i = 0; i < v->count; i++)
+				lval_free(v->cell[i]);
+			lfree(v->cell - v->off, sizeof(struct lval *) * v->cap);
+		}
+		if (v->code)
+			lcode_free(v->code);
 		break;
 	case LVAL_FUN:
 		lenv_free(v->env);
-		lval_free(v->formals);
+		if (v->formals)
+			lval_free(v->formals);
 		lval_free(v->body);
 		break;
+	case LVAL_VEC:
+		lfree(v->vec, sizeof(int64_t) * v->vec_len);
+		break;
 	case LVAL_FUN_BUILTIN:
 		break;
 	case LVAL_NUM:
 		break;
 	}
-	free(v);
-}
-
-static struct lval *lval_read_num(mpc_ast_t *t)
-{
-	errno = 0;
-	long x = strtol(t->contents, NULL, 0);
-	return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+	lgc_free(v);
 }
 
-static struct lval *lval_add(struct lval *v, struct lval *x)
+/* Free what v owns except for the lvals it references, used by the
+ * collector on garbage whose children are dealt with separately
+ */
+void lval_free_shallow(struct lval *v)
 {
-	v->count++;
-	v->cell = reallocarray(v->cell, v->count, sizeof(struct lval *));
-	v->cell[v->count - 1] = x;
-	return v;
+	switch (ltype(v)) {
+	case LVAL_ERR:
+		free(v->err);
+		break;
+	case LVAL_SYM:
+		if (v->scope)
+			lscope_free(v->scope);
+		break;
+	case LVAL_CHARBUF:
+		if (v->charbuf_cap >= 0)
+			free(v->charbuf);
+		break;
+	case LVAL_SEXPR: /* fall through */
+	case LVAL_QEXPR:
+		if (!lval_is_view(v))
+			lfree(v->cell - v->off, sizeof(struct lval *) * v->cap);
+		if (v->code)
+			lcode_free_shallow(v->code);
+		break;
+	case LVAL_FUN:
+		lenv_free_shallow(v->env);
+		break;
+	case LVAL_VEC:
+		lfree(v->vec, sizeof(int64_t) * v->vec_len);
+		break;
+	}
 }
 
-static struct lval *lval_read(mpc_ast_t *t)
+/* call fn on every lval v references */
+void lval_children(struct lval *v, void (*fn)(struct lval *))
 {
 	int i;
-	struct lval *x = NULL;
-
-	/* return conversion to type */
-	if (strstr(t->tag, "number"))
-		return lval_read_num(t);
-	else if (strstr(t->tag, "symbol"))
-		return lval_sym(t->contents);
-	else if (strstr(t->tag, "charbuf"))
-		return lval_read_str(t);
-
-	/* create empty list for root (>) or sexpr*/
-	else if (strstr(t->tag, "qexpr"))
-		x = lval_qexpr();
-	else if (strcmp(t->tag, ">") == 0)
-		x = lval_sexpr();
-	else if (strcmp(t->tag, "sexpr"))
-		x = lval_sexpr();
-	else
-		die("Invalid tag %s in lval_read", t->tag);
 
-	/* put expression in list */
-	for (i = 0; i < t->children_num; i++) {
-		if (strcmp(t->children[i]->contents, "(") == 0)
-			continue;
-		if (strcmp(t->children[i]->contents, ")") == 0)
-			continue;
-		if (strcmp(t->children[i]->contents, "{") == 0)
-			continue;
-		if (strcmp(t->children[i]->contents, "}") == 0)
-			continue;
-		if (strcmp(t->children[i]->tag, "regex") == 0)
-			continue;
-		if (strstr(t->children[i]->tag, "comment"))
-			continue;
-		x = lval_add(x, lval_read(t->children[i]));
+	switch (ltype(v)) {
+	case LVAL_CHARBUF:
+		if (lval_is_rope(v)) {
+			fn(v->rope_left);
+			fn(v->rope_right);
+		} else if (lval_is_str_view(v)) {
+			fn(v->charbuf_base);
+		}
+		break;
+	case LVAL_SEXPR: /* fall through */
+	case LVAL_QEXPR:
+		if (lval_is_view(v))
+			fn(v->base);
+		else
+			for (i = 0; i < v->count; i++)
+				fn(v->cell[i]);
+		if (v->code)
+			lcode_children(v->code, fn);
+		break;
+	case LVAL_FUN:
+		lenv_children(v->env, fn);
+		if (v->formals)
+			fn(v->formals);
+		fn(v->body);
+		break;
 	}
-	return x;
 }
 
-/* same as lval_expr_print, but return a char * with the contents */
-static char *lval_expr_to_str(struct lenv *e, struct lval *v, char open,
-			      char close)
+/* compiled code of a list is stale once the list is modified */
+static void lval_uncompile(struct lval *v)
 {
-	int i;
-	char *new_buf, *old_buf;
-	if (v->count == 0)
-		return String("%c%c", open, close);
-
-	/* initialize empty buffer for first concat */
-	old_buf = xmalloc(1);
-	old_buf[0] = '\0';
-
-	/* append trailing space for all but last element */
-	for (i = 0; i < v->count - 1; i++) {
-		char *s = lval_to_str(e, v->cell[i]);
-		new_buf = String("%s%s ", old_buf, s);
-		free(old_buf);
-		free(s);
-		old_buf = new_buf;
-	}
-	char *s = lval_to_str(e, v->cell[i]);
-	new_buf = String("%s%s", old_buf, s);
-	free(old_buf);
-	free(s);
-	char *out = String("%c%s%c", open, new_buf, close);
-	free(new_buf);
-	return out;
+	if (v->code) {
+		lcode_free(v->code);
+		v->code = NULL;
+	}
 }
 
-/* Variadic heap allocated string builder. */
-char *String(char *s, ...)
+/* make room for front more cells before the first one and back more after
+ * the last one, the allocation at least doubles when it has to grow
+ */
+static void lval_reserve(struct lval *v, int front, int back)
 {
-	int size = 512;
-	char *buf = xmalloc(size);
-	va_list va;
-	va_start(va, s);
+	struct lval **mem = v->cell - v->off;
+	int cap, off;
 
-	/* printf the error string with a maximum of 511 characters */
-	vsnprintf(buf, 511, s, va);
+	if (v->off >= front && v->cap - v->off - v->count >= back)
+		return;
 
-	/* Reallocate to number of bytes actually used */
-	buf = realloc(buf, strlen(buf) + 1);
+	cap = v->cap ? v->cap * 2 : 4;
+	while (cap < v->count + front + back)
+		cap *= 2;
 
-	return buf;
+	if (!front && !v->off) {
+		mem = lrealloc(mem, sizeof(struct lval *) * v->cap,
+			       sizeof(struct lval *) * cap);
+		off = 0;
+	} else {
+		/* the spare room goes to the end that is growing */
+		mem = lalloc(sizeof(struct lval *) * cap);
+		off = front ? cap - v->count - back : 0;
+		if (v->count)
+			memcpy(mem + off, v->cell,
+			       sizeof(struct lval *) * v->count);
+		lfree(v->cell - v->off, sizeof(struct lval *) * v->cap);
+	}
+	v->cell = mem + off;
+	v->cap = cap;
+	v->off = off;
 }
 
-static char *lval_str_to_str(struct lval *v)
+struct lval *lval_add(struct lval *v, struct lval *x)
 {
-	char *escaped = xmalloc(strlen(v->charbuf) + 1);
-	strcpy(escaped, v->charbuf);
-	escaped = mpcf_escape(escaped);
-	return escaped;
+	lval_uncompile(v);
+	lval_reserve(v, 0, 1);
+	v->cell[v->count++] = x;
+	return v;
 }
 
-/* returns a str representation of an lval for internal usage
+/* Reader
  *
- * @param v: lval to convert
- * @return: char * representation of lval
+ * Builds lvals straight from the text in one pass. The grammar is the one
+ * the interpreter always had:
+ *
+ *   number  : /-?[0-9]+/ ;
+ *   charbuf : /"(\\.|[^"])*"/ ;
+ *   symbol  : /[a-zA-Z0-9_+\-*\/\\=<>!&%^~|]+/ ;
+ *   sexpr   : '(' <expr>* ')' ;
+ *   qexpr   : '{' <expr>* '}' ;
+ *   expr    : <number> | <symbol> | <charbuf> | <sexpr> | <qexpr> ;
+ *
+ * Alternatives are tried in order and need nothing between them, "5x" is 5
+ * followed by x. Whitespace and comments, from ';' to the end of the line,
+ * are skipped between expressions.
  */
-char *lval_to_str(struct lenv *e, struct lval *v)
+struct lreader {
+	const char *name;
+	const char *s; /* NUL terminated */
+	long pos;
+	char *err;
+
+	/* Reading from f, s is buf which holds the len bytes read so far.
+	 * Text before pos is dropped once it is half of buf, line and col
+	 * are where s starts.
+	 */
+	FILE *f;
+	char *buf;
+	long len;
+	long cap;
+	long line;
+	long col;
+};
+
+static const char lread_sym_chars[256] = {
+	['a' ... 'z'] = 1, ['A' ... 'Z'] = 1, ['0' ... '9'] = 1,
+	['_'] = 1, ['+'] = 1, ['-'] = 1, ['*'] = 1, ['/'] = 1, ['\\'] = 1,
+	['='] = 1, ['<'] = 1, ['>'] = 1, ['!'] = 1, ['&'] = 1, ['%'] = 1,
+	['^'] = 1, ['~'] = 1, ['|'] = 1,
+};
+
+static inline int lread_is_sym(char c)
 {
-	switch (v->type) {
-	case LVAL_NUM:
-		return String("%li", v->num);
-	case LVAL_ERR:
-		return String("Err: %s", v->err);
-	case LVAL_SYM:
-		return String("%s", v->sym);
-	case LVAL_SEXPR:
-		return lval_expr_to_str(e, v, '(', ')');
-	case LVAL_CHARBUF:
-		return lval_str_to_str(v);
-	case LVAL_QEXPR:
-		return lval_expr_to_str(e, v, '{', '}');
-	case LVAL_FUN: {
-		char *formals = lval_to_str(e, v->formals);
-		char *body = lval_to_str(e, v->body);
-		char *out = String("%s %s %s", lenv_lookup_sym_by_val(e, v),
-				   formals, body);
-		free(formals);
-		free(body);
-		return out;
-	}
-	case LVAL_FUN_BUILTIN:
-		return String("<builtin function '%s'>",
-			      lenv_lookup_sym_by_val(e, v));
-	default:
-		return String("Unknown lval type!");
-	}
+	return lread_sym_chars[(unsigned char)c];
 }
 
-static void lval_println(struct lenv *e, struct lval *v)
+static inline int lread_is_digit(char c)
 {
-	char *str = lval_to_str(e, v);
-	printf("%s\n", str);
-	free(str);
+	return c >= '0' && c <= '9';
 }
 
-struct lval *lval_eval_sexpr(struct lenv *e, struct lval *v)
+static void lread_skip(struct lreader *r)
 {
-	int i;
-	const char fname[] = "eval_sexpr";
+	const char *s = r->s;
+	long pos = r->pos;
 
-	/* eval children*/
-	for (i = 0; i < v->count; i++) {
-		v->cell[i] = lval_eval(e, v->cell[i]);
+	for (;;) {
+		while (s[pos] == ' ' || (s[pos] >= '\t' && s[pos] <= '\r'))
+			pos++;
+		if (s[pos] != ';')
+			break;
+		while (s[pos] && s[pos] != '\n' && s[pos] != '\r')
+			pos++;
 	}
+	r->pos = pos;
+}
 
-	/* empty expressions */
-	if (v->count == 0)
-		return v;
-
-	/* single expressions */
-	if (v->count == 1)
-		return lval_take(v, 0);
-
-	/* ensure first elem is func */
-	struct lval *f = lval_pop(v, 0);
-	if (f->type != LVAL_FUN && f->type != LVAL_FUN_BUILTIN) {
-		struct lval *out =
-			lerr_args_type(e, f, fname, LVAL_FUN, f->type);
-		lval_free(f);
-		lval_free(v);
-		return out;
+/* move line and col past the first n characters of s */
+static void lread_count(const char *s, long n, long *line, long *col)
+{
+	long i;
+	for (i = 0; i < n; i++) {
+		if (s[i] == '\n') {
+			(*line)++;
+			*col = 1;
+		} else {
+			(*col)++;
+		}
 	}
-
-	struct lval *result = lval_call(e, f, v);
-	lval_free(f);
-	return result;
 }
 
-struct lval *lval_join_qexpr(struct lval *x, struct lval *y)
+static void lread_error(struct lreader *r, const char *expected)
 {
-	while (y->count)
-		x = lval_add(x, lval_pop(y, 0));
-	free(y);
-	return x;
+	long line = r->line, col = r->col;
+	char c = r->s[r->pos];
+
+	lread_count(r->s, r->pos, &line, &col);
+	if (c)
+		r->err = String("%s:%ld:%ld: error: expected %s at '%c'",
+				r->name, line, col, expected, c);
+	else
+		r->err = String("%s:%ld:%ld: error: expected %s at end of input",
+				r->name, line, col, expected);
 }
 
-struct lval *lval_join_charbuf(struct lenv *e, struct lval *a)
+static struct lval *lread_num(struct lreader *r, long n)
 {
-	int space = 0;
-	int i;
-	for (i = 0; i < a->count; i++) {
-		space += strlen(a->cell[i]->charbuf);
-	}
-	char *buf = xmalloc(space + 1);
-	buf[0] = '\0';
-	for (i = 0; i < a->count; i++) {
-		strcat(buf, a->cell[i]->charbuf);
-	}
-	struct lval *out = lval_str(buf);
-	free(buf);
-	return out;
+	char tmp[32];
+	char *buf = n < (long)sizeof(tmp) ? tmp : xmalloc(n + 1);
+	long x;
+
+	/* strtol() would read on past the digits, e.g. into "0x1" */
+	memcpy(buf, r->s + r->pos, n);
+	buf[n] = '\0';
+	r->pos += n;
+	errno = 0;
+	x = strtol(buf, NULL, 0);
+	if (buf != tmp)
+		free(buf);
+	return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
 }
 
-struct lval *lval_eval(struct lenv *e, struct lval *v)
-{
-	if (v->type == LVAL_SYM) {
-		struct lval *x = lenv_get(e, v);
-		lval_free(v);
-		return x;
+/* the escapes lval_write_charbuf() writes */
+static char lread_unescape(char c)
+{
+	switch (c) {
+	case 'a':
+		return '\a';
+	case 'b':
+		return '\b';
+	case 'f':
+		return '\f';
+	case 'n':
+		return '\n';
+	case 'r':
+		return '\r';
+	case 't':
+		return '\t';
+	case 'v':
+		return '\v';
+	case '\\':
+	case '\'':
+	case '"':
+		return c;
+	case '0':
+		return '\0';
+	default:
+		return -1;
 	}
-	if (v->type == LVAL_SEXPR)
-		return lval_eval_sexpr(e, v);
-	return v;
 }
 
-/* TODO: optimization - if i==0, no need to allocate mem */
-struct lval *lval_pop(struct lval *v, int i)
+static struct lval *lread_str(struct lreader *r)
 {
-	struct lval *x = v->cell[i];
-	memmove(&v->cell[i], &v->cell[i + 1],
-		sizeof(struct lval *) * (v->count - i - 1));
-	v->count--;
-	v->cell = reallocarray(v->cell, v->count, sizeof(struct lval *));
-	return x;
+	const char *s = r->s + r->pos + 1;
+	long n = 0;
+	char *buf, *w;
+
+	while (s[n] != '"') {
+		if (!s[n]) {
+			r->pos += n + 1;
+			lread_error(r, "'\"'");
+			return NULL;
+		}
+		n += s[n] == '\\' && s[n + 1] ? 2 : 1;
+	}
+
+	w = buf = xmalloc(n + 1);
+	while (s < r->s + r->pos + 1 + n) {
+		char c;
+		if (*s == '\\' && (c = lread_unescape(s[1])) != -1) {
+			*w++ = c;
+			s += 2;
+		} else {
+			*w++ = *s++;
+		}
+	}
+	*w = '\0';
+	r->pos += n + 2;
+	return lval_str_own(buf, w - buf, n + 1);
 }
 
-struct lval *lval_take(struct lval *v, int i)
+static struct lval *lread_expr(struct lreader *r);
+
+static struct lval *lread_list(struct lreader *r, struct lval *x, char close)
 {
-	struct lval *x = lval_pop(v, i);
-	lval_free(v);
-	return x;
+	r->pos++;
+	for (;;) {
+		lread_skip(r);
+		if (r->s[r->pos] == close) {
+			r->pos++;
+			return x;
+		}
+		if (!r->s[r->pos]) {
+			lread_error(r, close == ')' ? "')'" : "'}'");
+			lval_free(x);
+			return NULL;
+		}
+		struct lval *y = lread_expr(r);
+		if (!y) {
+			lval_free(x);
+			return NULL;
+		}
+		lval_add(x, y);
+	}
 }
 
-static struct lval *lval_copy(struct lval *v)
+/* read the expression at r->pos, NULL with r->err set on a syntax error */
+static struct lval *lread_expr(struct lreader *r)
 {
-	struct lval *x;
-	int i;
-
-	switch (v->type) {
-	/* copy direct */
-	case LVAL_FUN:
-		x = xmalloc(sizeof(struct lval));
-		x->type = v->type;
-		x->env = lenv_copy(v->env);
-		x->formals = lval_copy(v->formals);
-		x->body = lval_copy(v->body);
-		break;
-	case LVAL_FUN_BUILTIN:
-		x = xmalloc(sizeof(struct lval));
-		x->type = v->type;
-		x->builtin = v->builtin;
-		break;
-
-	case LVAL_NUM:
-		x = lval_num(v->num);
-		break;
-
-	/* copy strings */
-	case LVAL_ERR:
-		x = lval_err(v->err);
-		break;
-	case LVAL_SYM:
-		x = lval_sym(v->sym);
-		break;
-	case LVAL_CHARBUF:
-		x = lval_str(v->charbuf);
-		break;
+	const char *s = r->s + r->pos;
+	long n = s[0] == '-';
 
-	/* copy lists */
-	case LVAL_SEXPR: /*fallthrough*/
-	case LVAL_QEXPR: {
-		x = xmalloc(sizeof(struct lval));
-		x->type = v->type;
-		x->count = v->count;
-		if (x->count)
-			x->cell = xmalloc(sizeof(struct lval *) * x->count);
-		else
-			x->cell = NULL;
-		for (i = 0; i < x->count; i++)
-			x->cell[i] = lval_copy(v->cell[i]);
-		break;
+	if (lread_is_digit(s[n])) {
+		while (lread_is_digit(s[n]))
+			n++;
+		return lread_num(r, n);
 	}
-	default: {
-		/* Leaks mem, but this should never happen */
-		x = xmalloc(sizeof(struct lval));
-		x = lval_err(
-			String("Unknown lval type: %s", ltype_name(v->type)));
-		break;
+	if (lread_is_sym(s[0])) {
+		for (n = 0; lread_is_sym(s[n]); n++)
+			;
+		r->pos += n;
+		return lval_sym_n(s, n);
 	}
+	switch (s[0]) {
+	case '"':
+		return lread_str(r);
+	case '(':
+		return lread_list(r, lval_sexpr(), ')');
+	case '{':
+		return lread_list(r, lval_qexpr(), '}');
 	}
-	return x;
+	lread_error(r, "one of '(', '{', number, symbol, charbuf");
+	return NULL;
 }
 
-/* lenv funcs */
-static struct lenv *lenv_new(void)
+/* read the next line of r->f into the buffer, 0 at the end of the file */
+static int lread_fill(struct lreader *r)
 {
-	return xcalloc(sizeof(struct lenv));
-}
+	long n;
 
-static void lenv_free(struct lenv *e)
-{
-	int i;
-	for (i = 0; i < e->count; i++) {
-		free(e->syms[i]);
-		lval_free(e->vals[i]);
+	if (!r->f || feof(r->f) || ferror(r->f))
+		return 0;
+
+	if (r->pos > r->len - r->pos) {
+		lread_count(r->buf, r->pos, &r->line, &r->col);
+		r->len -= r->pos;
+		memmove(r->buf, r->buf + r->pos, r->len + 1);
+		r->pos = 0;
+	}
+	if (r->cap - r->len < 4096) {
+		r->cap = r->cap ? r->cap * 2 : 64 * 1024;
+		r->buf = realloc(r->buf, r->cap);
+		if (!r->buf)
+			die("%s", "failed to allocate memory\n");
+		r->s = r->buf;
 	}
-	free(e->syms);
-	free(e->vals);
-	free(e);
-}
 
-static int lenv_get_val_pos(struct lenv *e, struct lval *a)
+	/* a line at a time, the next form may already be complete */
+	if (!fgets(r->buf + r->len, r->cap - r->len, r->f)) {
+		r->buf[r->len] = '\0';
+		return 0;
+	}
+	n = strlen(r->buf + r->len);
+	r->len += n;
+	return 1;
+}
+
+/* Make sure the buffer holds all of the next form. Brackets, strings and
+ * comments are tracked without building anything, the form ends with its
+ * closing bracket or quote or, for a number or symbol, with the first
+ * character that can't be part of one.
+ */
+static void lread_want_form(struct lreader *r)
+{
+	int depth = 0, escape = 0;
+	char mode = 0; /* '"' in a string, ';' in a comment, 'a' in an atom */
+	long i = 0;
+	char c;
+
+	for (;;) {
+		c = r->s[r->pos + i];
+		if (!c) {
+			if (!lread_fill(r))
+				return;
+			continue;
+		}
+		i++;
+		switch (mode) {
+		case '"':
+			if (escape)
+				escape = 0;
+			else if (c == '\\')
+				escape = 1;
+			else if (c == '"') {
+				mode = 0;
+				if (!depth)
+					return;
+			}
+			continue;
+		case ';':
+			if (c == '\n' || c == '\r')
+				mode = 0;
+			continue;
+		case 'a':
+			if (lread_is_sym(c))
+				continue;
+			mode = 0;
+			if (!depth)
+				return;
+			break;
+		}
+		if (c == ' ' || (c >= '\t' && c <= '\r'))
+			continue;
+		if (c == '"' || c == ';')
+			mode = c;
+		else if (lread_is_sym(c))
+			mode = 'a';
+		else if (c == '(' || c == '{')
+			depth++;
+		else if (c == ')' || c == '}') {
+			if (--depth <= 0)
+				return;
+		} else if (!depth) {
+			return;
+		}
+	}
+}
+
+/* next top level expression, NULL at the end of the input or with r->err
+ * set on a syntax error
+ */
+static struct lval *lread_next(struct lreader *r)
 {
-	int i;
-	for (i = 0; i < e->count; i++) {
-		if (lval_eq(e->vals[i], a))
-			return i;
+	if (r->f)
+		lread_want_form(r);
+	lread_skip(r);
+	if (!r->s[r->pos])
+		return NULL;
+	return lread_expr(r);
+}
+
+/* read every expression in the NUL terminated text s into an S-expression,
+ * on a syntax error *err is set to a message the caller frees
+ */
+static struct lval *lread_all(const char *name, const char *s, char **err)
+{
+	struct lreader r = { .name = name, .s = s, .line = 1, .col = 1 };
+	struct lval *x = lval_sexpr();
+	struct lval *y;
+
+	while ((y = lread_next(&r)))
+		lval_add(x, y);
+	if (r.err) {
+		lval_free(x);
+		x = NULL;
 	}
-	return -1;
+	*err = r.err;
+	return x;
 }
 
-static int lenv_get_sym_pos(struct lenv *e, char *sym)
+/* same as lval_expr_print, but return a char * with the contents */
+static void lval_write(struct lbuf *b, struct lenv *e, struct lval *v);
+
+static void lval_write_expr(struct lbuf *b, struct lenv *e, struct lval *v,
+			    char open, char close)
 {
 	int i;
-	for (i = 0; i < e->count; i++) {
-		if (strcmp(e->syms[i], sym) == 0)
-			return i;
+	lbuf_putc(b, open);
+	for (i = 0; i < v->count; i++) {
+		if (i)
+			lbuf_putc(b, ' ');
+		lval_write(b, e, v->cell[i]);
 	}
-	return -1;
+	lbuf_putc(b, close);
 }
 
-static struct lval *lenv_get(struct lenv *e, struct lval *l)
+/* Variadic heap allocated string builder. */
+char *String(char *s, ...)
 {
-	int pos = lenv_get_sym_pos(e, l->sym);
-	if (pos != -1)
-		return lval_copy(e->vals[pos]);
-	else if (e->par)
-		return lenv_get(e->par, l);
-	return lval_err("unbound symbol '%s'", l->sym);
+	struct lbuf b;
+	va_list va;
+	va_start(va, s);
+	lbuf_init(&b, NULL);
+	lbuf_vprintf(&b, s, va);
+	va_end(va);
+	return lbuf_take(&b);
+}
+
+static void lval_write_vec(struct lbuf *b, struct lval *v)
+{
+	long i;
+
+	lbuf_putc(b, '[');
+	for (i = 0; i < v->vec_len; i++)
+		lbuf_printf(b, i ? " %" PRId64 : "%" PRId64, v->vec[i]);
+	lbuf_putc(b, ']');
+}
+
+/* the escapes lread_unescape() reads, NULL if c is printed as it is */
+static const char *lval_escape(char c)
+{
+	switch (c) {
+	case '\a':
+		return "\\a";
+	case '\b':
+		return "\\b";
+	case '\f':
+		return "\\f";
+	case '\n':
+		return "\\n";
+	case '\r':
+		return "\\r";
+	case '\t':
+		return "\\t";
+	case '\v':
+		return "\\v";
+	case '\\':
+		return "\\\\";
+	case '\'':
+		return "\\'";
+	case '"':
+		return "\\\"";
+	case '\0':
+		return "\\0";
+	default:
+		return NULL;
+	}
 }
 
-static struct lenv *lenv_copy(struct lenv *e)
+/* runs of characters without an escape are copied as they are */
+static void lval_write_charbuf(struct lbuf *b, const char *s, long n)
 {
-	int i;
-	struct lenv *n = xmalloc(sizeof(struct lenv));
-	n->par = e->par;
-	n->count = e->count;
-	n->syms = xmalloc(sizeof(char *) * n->count);
-	n->vals = xmalloc(sizeof(struct lval *) * n->count);
-	for (i = 0; i < e->count; i++) {
-		n->syms[i] = xmalloc(strlen(e->syms[i]) + 1);
-		strcpy(n->syms[i], e->syms[i]);
-		n->vals[i] = lval_copy(e->vals[i]);
+	const char *esc;
+	long i, start = 0;
+
+	for (i = 0; i < n; i++) {
+		if (!(esc = lval_escape(s[i])))
+			continue;
+		lbuf_put(b, s + start, i - start);
+		lbuf_puts(b, esc);
+		start = i + 1;
 	}
-	return n;
+	lbuf_put(b, s + start, n - start);
 }
 
-/* Add "variable" (k/v pair) to the local environment
+/* Append the printed form of v to b */
+static void lval_write(struct lbuf *b, struct lenv *e, struct lval *v)
+{
+	switch (ltype(v)) {
+	case LVAL_NUM:
+		lbuf_printf(b, "%li", lnum(v));
+		break;
+	case LVAL_ERR:
+		lbuf_printf(b, "Err: %s", v->err);
+		break;
+	case LVAL_SYM:
+		lbuf_puts(b, v->sym);
+		break;
+	case LVAL_SEXPR:
+		lval_write_expr(b, e, v, '(', ')');
+		break;
+	case LVAL_CHARBUF:
+		lval_write_charbuf(b, lval_str_bytes(v), v->charbuf_len);
+		break;
+	case LVAL_QEXPR:
+		lval_write_expr(b, e, v, '{', '}');
+		break;
+	case LVAL_VEC:
+		lval_write_vec(b, v);
+		break;
+	case LVAL_FUN:
+		lbuf_puts(b, lval_fun_name(e, v));
+		lbuf_putc(b, ' ');
+		lval_write(b, e, v->formals);
+		lbuf_putc(b, ' ');
+		lval_write(b, e, v->body);
+		break;
+	case LVAL_FUN_BUILTIN:
+		lbuf_printf(b, "<builtin function '%s'>",
+			    lbuiltin_name(v->builtin));
+		break;
+	default:
+		lbuf_puts(b, "Unknown lval type!");
+		break;
+	}
+}
+
+/* returns a str representation of an lval for internal usage
  *
- * @param e: environment to put variables in
- * @param k: lval of variable names
- * @param v: lval of values
+ * @param v: lval to convert
+ * @return: char * representation of lval
  */
-static void lenv_put(struct lenv *e, struct lval *k, struct lval *v)
+char *lval_to_str(struct lenv *e, struct lval *v)
 {
-	int i = lenv_get_sym_pos(e, k->sym);
+	struct lbuf b;
+	lbuf_init(&b, NULL);
+	lval_write(&b, e, v);
+	return lbuf_take(&b);
+}
 
-	/* exists, replace */
-	if (i != -1) {
-		lval_free(e->vals[i]);
-		e->vals[i] = lval_copy(v);
-		return;
-	}
+/* printed straight to stdout, the string is never built */
+static void lval_println(struct lenv *e, struct lval *v)
+{
+	struct lbuf b;
+	lbuf_init(&b, stdout);
+	lval_write(&b, e, v);
+	lbuf_putc(&b, '\n');
+	lbuf_flush(&b);
+}
 
-	/* does not exist, create*/
-	e->count++;
-	e->vals = reallocarray(e->vals, e->count, sizeof(struct lval *));
-	e->syms = reallocarray(e->syms, e->count, sizeof(char *));
+struct lval *lval_join_qexpr(struct lval *x, struct lval *y)
+{
+	int i;
+
+	/* (join {a} (f rest)) builds lists from the back, put the shorter x
+	 * in front of y when y is ours to modify instead of copying all of y
+	 */
+	if (x->count < y->count && y->refs == 1 && !lval_is_view(y)) {
+		lval_uncompile(y);
+		lval_reserve(y, x->count, 0);
+		y->cell -= x->count;
+		y->off -= x->count;
+		for (i = 0; i < x->count; i++)
+			y->cell[i] = lval_ref(x->cell[i]);
+		y->count += x->count;
+		lval_free(x);
+		return y;
+	}
 
-	/* copy */
-	e->vals[e->count - 1] = lval_copy(v);
-	e->syms[e->count - 1] = xmalloc(strlen(k->sym) + 1);
-	strcpy(e->syms[e->count - 1], k->sym);
+	x = lval_cow(x);
+	lval_reserve(x, 0, y->count);
+	for (i = 0; i < y->count; i++)
+		x = lval_add(x, lval_ref(y->cell[i]));
+	lval_free(y);
+	return x;
 }
 
-/* Add "variable" (k/v pair) to the global environment
+/* Join the charbufs in a, a is not consumed
  *
- * @param e: environment to find global from
- * @param k: lval of variable names
- * @param v: lval of values
+ * Joined charbufs get room in powers of two. A first charbuf nothing else
+ * refers to is extended in place, so building a string by repeated joins is
+ * linear. The sizes also let malloc reuse the memory of the charbufs freed
+ * along the way instead of mapping new pages for every slightly larger one.
+ * Otherwise a result of LROPE_MIN bytes or more is a rope of the arguments,
+ * so joining onto a shared charbuf doesn't copy it.
  */
-static void lenv_def(struct lenv *e, struct lval *k, struct lval *v)
+struct lval *lval_join_charbuf(struct lenv *e, struct lval *a)
 {
-	while (e->par)
-		e = e->par;
-	lenv_put(e, k, v);
-}
+	struct lval *out = a->cell[0], *x;
+	long len = 0, cap;
+	int i;
 
-static void lenv_add_builtin(struct lenv *e, char *name, lbuiltin func)
-{
-	struct lval *k = lval_sym(name);
-	struct lval *v = lval_builtin(func);
-	lenv_put(e, k, v);
-	lval_free(k);
-	lval_free(v);
+	for (i = 0; i < a->count; i++)
+		len += a->cell[i]->charbuf_len;
+	for (cap = 16; cap < len + 1; cap *= 2)
+		;
+
+	if (out->refs == 1 && out->charbuf_cap >= 0) {
+		out = lval_ref(out);
+		if (len + 1 > out->charbuf_cap) {
+			out->charbuf = realloc(out->charbuf, cap);
+			if (!out->charbuf)
+				die("%s", "failed to allocate memory\n");
+			out->charbuf_cap = cap;
+		}
+		i = 1;
+	} else if (len >= LROPE_MIN) {
+		out = lval_ref(out);
+		for (i = 1; i < a->count; i++)
+			if (a->cell[i]->charbuf_len)
+				out = lval_rope(out, lval_ref(a->cell[i]));
+		return out;
+	} else {
+		out = lval_str_own(xmalloc(cap), 0, cap);
+		i = 0;
+	}
+	for (; i < a->count; i++) {
+		x = a->cell[i];
+		lrope_copy(x, out->charbuf + out->charbuf_len);
+		out->charbuf_len += x->charbuf_len;
+	}
+	out->charbuf[len] = '\0';
+	return out;
 }
 
-static void lenv_add_builtins(struct lenv *e)
+/* Evaluate v in e, v is consumed
+ *
+ * Tail positions (the body of a function, the branch selected by if, the
+ * expression passed to eval and the only child of a list) are evaluated by
+ * looping instead of recursing, so tail recursive code runs in constant C
+ * stack. The functions entered along the way are kept alive until the loop
+ * ends since their environments are on the chain of e. A self tail call
+ * replaces the frame of the running function instead, see below.
+ *
+ * Code is never modified, the values of the children go to a new list. A
+ * function body or a branch of if is run where it is, as the Q-Expression
+ * it was written as, which code set tells apart from a quoted value.
+ */
+static struct lval *lval_eval_code(struct lenv *e, struct lval *v, int code)
 {
-	lenv_add_builtin(e, "load", builtin_load);
-	lenv_add_builtin(e, "type", builtin_type);
-	lenv_add_builtin(e, "error", builtin_error);
-	lenv_add_builtin(e, "print", builtin_print);
+	int i;
+	const char fname[] = "eval_sexpr";
+	struct lval *f, *a, *out;
+	struct lval *fn = NULL; /* function whose environment is e */
+	struct lval *held = NULL; /* functions entered before fn */
+
+	for (;;) {
+		if (ltype(v) == LVAL_SYM) {
+			out = lenv_get(e, v);
+			lval_free(v);
+			break;
+		}
+		if (ltype(v) != LVAL_SEXPR &&
+		    !(code && ltype(v) == LVAL_QEXPR)) {
+			out = v;
+			break;
+		}
+		if (engine == ENGINE_VM) {
+			out = lvm_eval(e, v);
+			break;
+		}
 
-	/* list functions */
-	lenv_add_builtin(e, "list", builtin_list);
-	lenv_add_builtin(e, "head", builtin_head);
-	lenv_add_builtin(e, "tail", builtin_tail);
-	lenv_add_builtin(e, "eval", builtin_eval);
-	lenv_add_builtin(e, "join", builtin_join);
-	lenv_add_builtin(e, "def", builtin_def);
-	lenv_add_builtin(e, "put", builtin_put);
-	lenv_add_builtin(e, "\\", builtin_lambda);
+		/* single expressions evaluate to their child */
+		if (v->count == 1) {
+			f = lval_ref(v->cell[0]);
+			lval_free(v);
+			v = f;
+			code = 0;
+			continue;
+		}
 
-	/* math functions */
-	lenv_add_builtin(e, "+", builtin_add);
-	lenv_add_builtin(e, "-", builtin_sub);
-	lenv_add_builtin(e, "*", builtin_mul);
-	lenv_add_builtin(e, "/", builtin_div);
-	lenv_add_builtin(e, "%", builtin_mod);
+		/* empty expressions */
+		if (v->count == 0) {
+			if (ltype(v) == LVAL_SEXPR) {
+				out = v;
+			} else {
+				lval_free(v);
+				out = lval_sexpr();
+			}
+			break;
+		}
 
-	/* conditional */
-	lenv_add_builtin(e, "if", builtin_if);
+		/* eval children */
+		f = lval_eval(e, lval_ref(v->cell[0]));
+		a = lval_sexpr();
+		lval_reserve(a, 0, v->count - 1);
+		for (i = 1; i < v->count; i++)
+			a = lval_add(a, lval_eval(e, lval_ref(v->cell[i])));
+		lval_free(v);
+		v = a;
+		code = 1;
+
+		/* ensure first elem is func */
+		if (ltype(f) != LVAL_FUN && ltype(f) != LVAL_FUN_BUILTIN) {
+			out = lerr_args_type(e, f, fname, LVAL_FUN, ltype(f));
+			lval_free(f);
+			lval_free(v);
+			break;
+		}
 
-	/* equality */
-	lenv_add_builtin(e, "==", builtin_eq);
-	lenv_add_builtin(e, "!=", builtin_ne);
+		if (ltype(f) == LVAL_FUN_BUILTIN) {
+			if (f->builtin == builtin_if)
+				v = lval_if_branch(e, v);
+			else if (f->builtin == builtin_eval)
+				v = lval_unquote(e, v);
+			else {
+				out = f->builtin(e, v);
+				lval_free(f);
+				break;
+			}
+			lval_free(f);
+			continue;
+		}
 
-	/* order */
-	lenv_add_builtin(e, "<=", builtin_le);
-	lenv_add_builtin(e, "<", builtin_lt);
-	lenv_add_builtin(e, ">", builtin_gt);
-	lenv_add_builtin(e, ">=", builtin_ge);
+		out = lval_bind(e, f, v);
+		lval_free(f);
+		f = out;
 
-	/* logical */
-	lenv_add_builtin(e, "&&", builtin_and);
-	lenv_add_builtin(e, "||", builtin_or);
-	lenv_add_builtin(e, "!", builtin_not);
+		/* error or partial */
+		if (ltype(f) != LVAL_FUN || f->formals) {
+			out = f;
+			break;
+		}
 
-	/* bitwise */
-	lenv_add_builtin(e, "~", builtin_bitwise_not);
-	lenv_add_builtin(e, "|", builtin_bitwise_or);
-	lenv_add_builtin(e, "&", builtin_bitwise_and);
-	lenv_add_builtin(e, "^", builtin_bitwise_xor);
-	lenv_add_builtin(e, ">>", builtin_bitwise_right_shift);
-	lenv_add_builtin(e, "<<", builtin_bitwise_left_shift);
+		/* A self tail call binds the same names as the running frame,
+		 * if that frame holds nothing else no lookup can tell the
+		 * difference once it is dropped from the chain.
+		 */
+		if (fn && fn->env->scope == f->env->scope &&
+		    fn->env->count == 0) {
+			f->env->par = fn->env->par;
+			lval_free(fn);
+		} else {
+			/* set environment parent to evaluation environment */
+			f->env->par = e;
+			if (fn)
+				held = lval_add(held ? held : lval_sexpr(), fn);
+		}
+		fn = f;
+		e = f->env;
 
-	/* testing */
-	lenv_add_builtin(e, "assert", builtin_assert);
-	lenv_add_builtin(e, "assert_err", builtin_assert_err);
+		/* the body is shared by every copy of f */
+		v = lval_ref(f->body);
+	}
+
+	if (fn)
+		lval_free(fn);
+	if (held)
+		lval_free(held);
+	return out;
 }
 
-static struct lval *lenv_load(struct lenv *e, char *file)
+struct lval *lval_eval(struct lenv *e, struct lval *v)
 {
-	/* parse file of string name */
-	mpc_result_t r;
-	if (mpc_parse_contents(file, Lisp, &r)) {
-		struct lval *expr = lval_read(r.output);
-		int i = 1;
-		mpc_ast_delete(r.output);
-		while (expr->count) {
-			struct lval *x = lval_eval(e, lval_pop(expr, 0));
-			if (x->type == LVAL_ERR) {
-				printf("\nLoad error in %s:%d\n\n", file, i);
-				lval_println(e, x);
-			}
-			lval_free(x);
-			i++;
-		}
-		lval_free(expr);
-		return lval_sexpr();
-	} else {
-		/* get parser error as string */
-		char *err_msg = mpc_err_string(r.error);
-		mpc_err_delete(r.error);
+	return lval_eval_code(e, v, 0);
+}
 
-		struct lval *err = lval_err("Could not load %s", err_msg);
-		free(err_msg);
-		return err;
+/* popping the first cell just moves the start of the list, the memory is
+ * kept for later lval_add() calls and freed with the list
+ */
+struct lval *lval_pop(struct lval *v, int i)
+{
+	struct lval *x = v->cell[i];
+	lval_uncompile(v);
+	if (i == 0) {
+		v->cell++;
+		v->off++;
+	} else {
+		memmove(&v->cell[i], &v->cell[i + 1],
+			sizeof(struct lval *) * (v->count - i - 1));
 	}
+	v->count--;
+	return x;
+}
+
+struct lval *lval_take(struct lval *v, int i)
+{
+	struct lval *x = lval_pop(v, i);
+	lval_free(v);
+	return x;
+}
+
+/* Take another reference to v
+ *
+ * Shared lvals are immutable, use lval_cow() before modifying one.
+ */
+struct lval *lval_ref(struct lval *v)
+{
+	if (!lval_is_fixnum(v))
+		v->refs++;
+	return v;
+}
+
+/* Return a version of v which is safe to modify in place
+ *
+ * If v is shared or a view a shallow copy is made and the reference to v is
+ * dropped, the children of the copy are shared with v.
+ */
+static struct lval *lval_cow(struct lval *v)
+{
+	if (lval_is_fixnum(v) || (v->refs == 1 && !lval_is_view(v)))
+		return v;
+	struct lval *x = lval_copy(v);
+	lval_free(v);
+	return x;
+}
+
+/* shallow copy, children are shared with v */
+static struct lval *lval_copy(struct lval *v)
+{
+	struct lval *x;
+	int i;
+
+	switch (ltype(v)) {
+	/* copy direct */
+	case LVAL_FUN:
+		x = lgc_alloc();
+		x->type = v->type;
+		x->refs = 1;
+		x->env = lenv_copy(v->env);
+		x->formals = v->formals ? lval_ref(v->formals) : NULL;
+		x->body = lval_ref(v->body);
+		x->name = v->name;
+		break;
+	case LVAL_FUN_BUILTIN:
+		x = lgc_alloc();
+		x->type = v->type;
+		x->refs = 1;
+		x->builtin = v->builtin;
+		break;
+
+	case LVAL_NUM:
+		x = lval_num(lnum(v));
+		break;
+
+	/* copy strings */
+	case LVAL_ERR:
+		x = lval_err("%s", v->err);
+		break;
+	case LVAL_SYM:
+		x = lval_sym(v->sym);
+		x->scope = v->scope;
+		x->depth = v->depth;
+		x->slot = v->slot;
+		if (x->scope)
+			x->scope->refs++;
+		break;
+	case LVAL_CHARBUF:
+		x = lval_str_n(lval_str_bytes(v), v->charbuf_len);
+		break;
+	case LVAL_VEC:
+		x = lval_vec(v->vec_len);
+		if (v->vec_len)
+			memcpy(x->vec, v->vec, sizeof(int64_t) * v->vec_len);
+		break;
+
+	/* copy lists */
+	case LVAL_SEXPR: /*fallthrough*/
+	case LVAL_QEXPR: {
+		x = lgc_alloc();
+		x->type = v->type;
+		x->refs = 1;
+		x->count = v->count;
+		x->cell = lalloc(sizeof(struct lval *) * x->count);
+		x->code = NULL;
+		x->cap = x->count;
+		x->off = 0;
+		for (i = 0; i < x->count; i++)
+			x->cell[i] = lval_ref(v->cell[i]);
+		break;
+	}
+	default: {
+		/* Leaks mem, but this should never happen */
+		x = lval_err(
+			String("Unknown lval type: %s", ltype_name(ltype(v))));
+		break;
+	}
+	}
+	return x;
+}
+
+/* lscope funcs */
+static struct lscope *lscope_new(struct lval *formals, struct lscope *par)
+{
+	int i, n = 0;
+	struct lscope *s = lalloc(sizeof(struct lscope));
+	/* & takes no slot, size syms exactly so lscope_free gives back the
+	 * same block size it got */
+	for (i = 0; i < formals->count; i++)
+		if (strcmp(formals->cell[i]->sym, "&") != 0)
+			n++;
+	s->refs = 1;
+	s->count = 0;
+	s->syms = lalloc(sizeof(char *) * n);
+	for (i = 0; i < formals->count; i++)
+		if (strcmp(formals->cell[i]->sym, "&") != 0)
+			s->syms[s->count++] = formals->cell[i]->sym;
+	s->par = par;
+	if (par)
+		par->refs++;
+	return s;
+}
+
+void lscope_free(struct lscope *s)
+{
+	while (s && --s->refs == 0) {
+		struct lscope *par = s->par;
+		lfree(s->syms, sizeof(char *) * s->count);
+		lfree(s, sizeof(struct lscope));
+		s = par;
+	}
+}
+
+/* slot of sym in s, the last one wins for repeated formals like lenv_put */
+static int lscope_slot(struct lscope *s, char *sym)
+{
+	int i;
+	for (i = s->count - 1; i >= 0; i--)
+		if (s->syms[i] == sym)
+			return i;
+	return -1;
+}
+
+/* Assign a lexical address to every symbol in v
+ *
+ * A symbol naming a formal of s, or of a scope s was created in, gets the
+ * number of scopes to walk up and the slot in that scope. Others are marked
+ * unresolved. The address is only a hint: lenv_get_addr() checks the frames
+ * it walks through match the scopes at runtime, so dynamic scoping and
+ * bodies evaluated outside their function still behave as before.
+ */
+static void lscope_addr(struct lscope *s, char *sym, struct lscope **scope,
+			int *depth, int *slot)
+{
+	struct lscope *it;
+	int d;
+	for (it = s, d = 0; it; it = it->par, d++) {
+		*slot = lscope_slot(it, sym);
+		if (*slot != -1) {
+			*scope = s;
+			*depth = d;
+			return;
+		}
+	}
+	*scope = NULL;
+	*depth = 0;
+	*slot = 0;
+}
+
+/* check if v and all its children already carry the addresses for s */
+static int lval_resolved(struct lval *v, struct lscope *s)
+{
+	int i, depth, slot;
+	struct lscope *scope;
+	switch (ltype(v)) {
+	case LVAL_SYM:
+		lscope_addr(s, v->sym, &scope, &depth, &slot);
+		return v->scope == scope && v->depth == depth &&
+		       v->slot == slot;
+	case LVAL_SEXPR: /* fallthrough */
+	case LVAL_QEXPR:
+		for (i = 0; i < v->count; i++)
+			if (!lval_resolved(v->cell[i], s))
+				return 0;
+		return 1;
+	default:
+		return 1;
+	}
+}
+
+static struct lval *lval_resolve(struct lval *v, struct lscope *s)
+{
+	int i, depth, slot;
+	struct lscope *scope;
+
+	/* leave shared trees alone when there is nothing to do */
+	if (lval_is_fixnum(v) || (v->refs > 1 && lval_resolved(v, s)))
+		return v;
+
+	switch (ltype(v)) {
+	case LVAL_SYM:
+		lscope_addr(s, v->sym, &scope, &depth, &slot);
+		v = lval_cow(v);
+		if (scope)
+			scope->refs++;
+		if (v->scope)
+			lscope_free(v->scope);
+		v->scope = scope;
+		v->depth = depth;
+		v->slot = slot;
+		break;
+	case LVAL_SEXPR: /* fallthrough */
+	case LVAL_QEXPR:
+		v = lval_cow(v);
+		lval_uncompile(v);
+		for (i = 0; i < v->count; i++)
+			v->cell[i] = lval_resolve(v->cell[i], s);
+		break;
+	}
+	return v;
+}
+
+/* lenv funcs */
+struct lenv *lenv_new(void)
+{
+	struct lenv *e = lalloc(sizeof(struct lenv));
+	memset(e, 0, sizeof(struct lenv));
+	return e;
+}
+
+/* new function frame with an unbound slot for each formal in scope */
+struct lenv *lenv_new_frame(struct lscope *scope)
+{
+	struct lenv *e = lenv_new();
+	e->scope = scope;
+	scope->refs++;
+	e->slots = lalloc(sizeof(struct lval *) * scope->count);
+	memset(e->slots, 0, sizeof(struct lval *) * scope->count);
+	return e;
+}
+
+void lenv_free(struct lenv *e)
+{
+	int i;
+	if (e->scope)
+		for (i = 0; i < e->scope->count; i++)
+			if (e->slots[i])
+				lval_free(e->slots[i]);
+	for (i = 0; i < e->count; i++)
+		lval_free(e->vals[i]);
+	lenv_free_shallow(e);
+}
+
+/* free e but not the values bound in it */
+static void lenv_free_shallow(struct lenv *e)
+{
+	if (e->scope) {
+		lfree(e->slots, sizeof(struct lval *) * e->scope->count);
+		lscope_free(e->scope);
+	}
+	lfree(e->syms, sizeof(char *) * e->cap);
+	lfree(e->vals, sizeof(struct lval *) * e->cap);
+	lfree(e->index, sizeof(int) * e->index_size);
+	lfree(e, sizeof(struct lenv));
+}
+
+/* call fn on every value bound in e */
+void lenv_children(struct lenv *e, void (*fn)(struct lval *))
+{
+	int i;
+	if (e->scope)
+		for (i = 0; i < e->scope->count; i++)
+			if (e->slots[i])
+				fn(e->slots[i]);
+	for (i = 0; i < e->count; i++)
+		fn(e->vals[i]);
+}
+
+static int lenv_get_val_pos(struct lenv *e, struct lval *a)
+{
+	int i;
+	for (i = 0; i < e->count; i++) {
+		if (lval_eq(e->vals[i], a))
+			return i;
+	}
+	return -1;
+}
+
+/* (Re)build the hash index over the entries of e
+ *
+ * The index holds entry position + 1 so that 0 marks an empty slot.
+ */
+static void lenv_reindex(struct lenv *e, int size)
+{
+	int i;
+	unsigned long j;
+	lfree(e->index, sizeof(int) * e->index_size);
+	e->index = lalloc(sizeof(int) * size);
+	memset(e->index, 0, sizeof(int) * size);
+	e->index_size = size;
+	for (i = 0; i < e->count; i++) {
+		j = lsym_hash_ptr(e->syms[i]) & (size - 1);
+		while (e->index[j])
+			j = (j + 1) & (size - 1);
+		e->index[j] = i + 1;
+	}
+}
+
+/* @param sym: interned symbol name */
+static int lenv_get_sym_pos(struct lenv *e, char *sym)
+{
+	int i;
+	unsigned long j;
+
+	/* small environments (function arguments) are scanned */
+	if (!e->index) {
+		for (i = 0; i < e->count; i++) {
+			if (e->syms[i] == sym)
+				return i;
+		}
+		return -1;
+	}
+
+	j = lsym_hash_ptr(sym) & (e->index_size - 1);
+	while ((i = e->index[j])) {
+		if (e->syms[i - 1] == sym)
+			return i - 1;
+		j = (j + 1) & (e->index_size - 1);
+	}
+	return -1;
+}
+
+/* Find the value bound to a resolved symbol by its lexical address
+ *
+ * Every frame walked through must belong to the scope the address was
+ * computed for and must not have picked up other bindings at runtime,
+ * otherwise NULL is returned and the caller falls back to a lookup by name.
+ */
+static struct lval *lenv_get_addr(struct lenv *e, struct lval *l)
+{
+	struct lscope *s = l->scope;
+	int depth = l->depth;
+
+	for (;;) {
+		if (!e || e->scope != s)
+			return NULL;
+		if (!depth--)
+			return e->slots[l->slot];
+		if (e->count)
+			return NULL;
+		e = e->par;
+		s = s->par;
+	}
+}
+
+struct lval *lenv_get(struct lenv *e, struct lval *l)
+{
+	int pos;
+	struct lval *x;
+
+	if (l->scope && (x = lenv_get_addr(e, l)))
+		return lval_ref(x);
+
+	for (; e; e = e->par) {
+		if (e->scope && (pos = lscope_slot(e->scope, l->sym)) != -1 &&
+		    e->slots[pos])
+			return lval_ref(e->slots[pos]);
+		pos = lenv_get_sym_pos(e, l->sym);
+		if (pos != -1)
+			return lval_ref(e->vals[pos]);
+	}
+	return lval_err("unbound symbol '%s'", l->sym);
+}
+
+static struct lenv *lenv_copy(struct lenv *e)
+{
+	int i;
+	struct lenv *n = lalloc(sizeof(struct lenv));
+	n->par = e->par;
+	n->scope = e->scope;
+	n->slots = NULL;
+	if (n->scope) {
+		n->scope->refs++;
+		n->slots = lalloc(sizeof(struct lval *) * n->scope->count);
+		for (i = 0; i < n->scope->count; i++)
+			n->slots[i] = e->slots[i] ? lval_ref(e->slots[i]) : NULL;
+	}
+	n->count = e->count;
+	n->cap = e->count;
+	n->syms = lalloc(sizeof(char *) * n->cap);
+	n->vals = lalloc(sizeof(struct lval *) * n->cap);
+	if (n->count)
+		memcpy(n->syms, e->syms, sizeof(char *) * n->count);
+	for (i = 0; i < e->count; i++)
+		n->vals[i] = lval_ref(e->vals[i]);
+	n->index = NULL;
+	n->index_size = 0;
+	if (e->index)
+		lenv_reindex(n, e->index_size);
+	return n;
+}
+
+/* Add "variable" (k/v pair) to the local environment
+ *
+ * @param e: environment to put variables in
+ * @param k: lval of variable names
+ * @param v: lval of values
+ */
+void lenv_put(struct lenv *e, struct lval *k, struct lval *v)
+{
+	int i;
+
+	/* formals are bound in their slot */
+	if (e->scope && (i = lscope_slot(e->scope, k->sym)) != -1) {
+		if (e->slots[i])
+			lval_free(e->slots[i]);
+		e->slots[i] = lval_ref(v);
+		return;
+	}
+
+	i = lenv_get_sym_pos(e, k->sym);
+
+	/* exists, replace */
+	if (i != -1) {
+		lval_free(e->vals[i]);
+		e->vals[i] = lval_ref(v);
+		return;
+	}
+
+	/* does not exist, create*/
+	if (e->count == e->cap) {
+		int cap = e->cap ? e->cap * 2 : LENV_MIN_CAP;
+		e->vals = lrealloc(e->vals, sizeof(struct lval *) * e->cap,
+				   sizeof(struct lval *) * cap);
+		e->syms = lrealloc(e->syms, sizeof(char *) * e->cap,
+				   sizeof(char *) * cap);
+		e->cap = cap;
+	}
+
+	/* reference, names are interned so the pointer is stored as is */
+	e->vals[e->count] = lval_ref(v);
+	e->syms[e->count] = k->sym;
+	e->count++;
+
+	/* keep the index load factor below 1/2 */
+	if (e->index && e->count * 2 > e->index_size) {
+		lenv_reindex(e, e->index_size * 2);
+	} else if (e->index) {
+		unsigned long j = lsym_hash_ptr(k->sym) & (e->index_size - 1);
+		while (e->index[j])
+			j = (j + 1) & (e->index_size - 1);
+		e->index[j] = e->count;
+	} else if (e->count > LENV_SCAN_MAX) {
+		lenv_reindex(e, LENV_SCAN_MAX * 4);
+	}
+}
+
+/* Add "variable" (k/v pair) to the global environment
+ *
+ * @param e: environment to find global from
+ * @param k: lval of variable names
+ * @param v: lval of values
+ */
+static void lenv_def(struct lenv *e, struct lval *k, struct lval *v)
+{
+	while (e->par)
+		e = e->par;
+	lenv_put(e, k, v);
+}
+
+/* every builtin with the name it was first added under, images refer to
+ * builtins by name since their addresses change between builds
+ */
+static struct {
+	char *name;
+	lbuiltin func;
+} *builtins;
+static int builtins_count;
+static int builtins_cap;
+
+char *lbuiltin_name(lbuiltin func)
+{
+	int i;
+	for (i = 0; i < builtins_count; i++)
+		if (builtins[i].func == func)
+			return builtins[i].name;
+	return NULL;
+}
+
+lbuiltin lbuiltin_by_name(const char *name)
+{
+	int i;
+	for (i = 0; i < builtins_count; i++)
+		if (strcmp(builtins[i].name, name) == 0)
+			return builtins[i].func;
+	return NULL;
+}
+
+static void lenv_add_builtin(struct lenv *e, char *name, lbuiltin func)
+{
+	struct lval *k = lval_sym(name);
+	if (!lbuiltin_name(func)) {
+		if (builtins_count == builtins_cap) {
+			builtins_cap = builtins_cap ? builtins_cap * 2 : 64;
+			builtins = realloc(builtins,
+					   sizeof(*builtins) * builtins_cap);
+			if (!builtins)
+				die("%s", "failed to allocate memory\n");
+		}
+		builtins[builtins_count].name = k->sym;
+		builtins[builtins_count].func = func;
+		builtins_count++;
+	}
+	struct lval *v = lval_builtin(func);
+	lenv_put(e, k, v);
+	lval_free(k);
+	lval_free(v);
+}
+
+static void lenv_add_builtins(struct lenv *e)
+{
+	lenv_add_builtin(e, "load", builtin_load);
+	lenv_add_builtin(e, "type", builtin_type);
+	lenv_add_builtin(e, "gc", builtin_gc);
+	lenv_add_builtin(e, "error", builtin_error);
+	lenv_add_builtin(e, "print", builtin_print);
+
+	/* data files */
+	lenv_add_builtin(e, "data-write", builtin_data_write);
+	lenv_add_builtin(e, "data-append", builtin_data_append);
+	lenv_add_builtin(e, "data-read", builtin_data_read);
+	lenv_add_builtin(e, "data-each", builtin_data_each);
+
+	/* list functions */
+	lenv_add_builtin(e, "list", builtin_list);
+	lenv_add_builtin(e, "head", builtin_head);
+	lenv_add_builtin(e, "tail", builtin_tail);
+	lenv_add_builtin(e, "eval", builtin_eval);
+	lenv_add_builtin(e, "join", builtin_join);
+	lenv_add_builtin(e, "list-len", builtin_list_len);
+	lenv_add_builtin(e, "list-nth", builtin_list_nth);
+	lenv_add_builtin(e, "list-last", builtin_list_last);
+	lenv_add_builtin(e, "list-take", builtin_list_take);
+	lenv_add_builtin(e, "list-drop", builtin_list_drop);
+	lenv_add_builtin(e, "list-split", builtin_list_split);
+	lenv_add_builtin(e, "list-map", builtin_list_map);
+	lenv_add_builtin(e, "list-filter", builtin_list_filter);
+	lenv_add_builtin(e, "list-foldl", builtin_list_foldl);
+
+	/* vector functions */
+	lenv_add_builtin(e, "vec", builtin_vec);
+	lenv_add_builtin(e, "vec-list", builtin_vec_list);
+	lenv_add_builtin(e, "vec-len", builtin_vec_len);
+	lenv_add_builtin(e, "vec+", builtin_vec_add);
+	lenv_add_builtin(e, "vec-", builtin_vec_sub);
+	lenv_add_builtin(e, "vec*", builtin_vec_mul);
+	lenv_add_builtin(e, "vec==", builtin_vec_eq);
+	lenv_add_builtin(e, "vec>", builtin_vec_gt);
+	lenv_add_builtin(e, "vec<", builtin_vec_lt);
+	lenv_add_builtin(e, "vec-sum", builtin_vec_sum);
+	lenv_add_builtin(e, "vec-min", builtin_vec_min);
+	lenv_add_builtin(e, "vec-max", builtin_vec_max);
+	lenv_add_builtin(e, "vec-dot", builtin_vec_dot);
+	lenv_add_builtin(e, "vec-isa", builtin_vec_isa);
+
+	/* charbuf functions */
+	lenv_add_builtin(e, "str-len", builtin_str_len);
+	lenv_add_builtin(e, "str-byte", builtin_str_byte);
+	lenv_add_builtin(e, "str-slice", builtin_str_slice);
+
+	lenv_add_builtin(e, "def", builtin_def);
+	lenv_add_builtin(e, "put", builtin_put);
+	lenv_add_builtin(e, "\\", builtin_lambda);
+
+	/* math functions */
+	lenv_add_builtin(e, "+", builtin_add);
+	lenv_add_builtin(e, "-", builtin_sub);
+	lenv_add_builtin(e, "*", builtin_mul);
+	lenv_add_builtin(e, "/", builtin_div);
+	lenv_add_builtin(e, "%", builtin_mod);
+
+	/* conditional */
+	lenv_add_builtin(e, "if", builtin_if);
+
+	/* equality */
+	lenv_add_builtin(e, "==", builtin_eq);
+	lenv_add_builtin(e, "!=", builtin_ne);
+
+	/* order */
+	lenv_add_builtin(e, "<=", builtin_le);
+	lenv_add_builtin(e, "<", builtin_lt);
+	lenv_add_builtin(e, ">", builtin_gt);
+	lenv_add_builtin(e, ">=", builtin_ge);
+
+	/* logical */
+	lenv_add_builtin(e, "&&", builtin_and);
+	lenv_add_builtin(e, "||", builtin_or);
+	lenv_add_builtin(e, "!", builtin_not);
+
+	/* bitwise */
+	lenv_add_builtin(e, "~", builtin_bitwise_not);
+	lenv_add_builtin(e, "|", builtin_bitwise_or);
+	lenv_add_builtin(e, "&", builtin_bitwise_and);
+	lenv_add_builtin(e, "^", builtin_bitwise_xor);
+	lenv_add_builtin(e, ">>", builtin_bitwise_right_shift);
+	lenv_add_builtin(e, "<<", builtin_bitwise_left_shift);
+
+	/* testing */
+	lenv_add_builtin(e, "assert", builtin_assert);
+	lenv_add_builtin(e, "assert_err", builtin_assert_err);
+}
+
+/* Map a regular file for reading with a zero byte after its end, the reader
+ * needs the terminator. The file is mapped over an anonymous mapping one
+ * byte longer, so the terminator is there even when the size is a multiple
+ * of the page size. NULL if f can't be mapped.
+ */
+static char *map_file(FILE *f, size_t *map_len)
+{
+	struct stat st;
+	long page = sysconf(_SC_PAGESIZE);
+	char *p;
+	size_t len;
+
+	/* pipes, and files like those in /proc which claim to be empty */
+	if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode) || !st.st_size)
+		return NULL;
+
+	len = (st.st_size + page) & ~(page - 1);
+	p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	if (mmap(p, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fileno(f),
+		 0) == MAP_FAILED) {
+		munmap(p, len);
+		return NULL;
+	}
+	madvise(p, len, MADV_SEQUENTIAL);
+	*map_len = len;
+	return p;
+}
+
+/* read text is given back to the kernel in steps of this many bytes */
+#define LOAD_DROP_BYTES (1L << 20)
+
+/* Files are evaluated and freed a form at a time so a long script or a pipe
+ * starts running right away, "-" is stdin. With collect set the collector
+ * may run between forms, only main sets it since a load called from code
+ * runs inside an evaluation whose values aren't reachable from e.
+ *
+ * Regular files are mapped and read in place, nothing read keeps pointing
+ * into the mapping: symbols are interned and strings copied (unescaped on
+ * the way), so it is unmapped at the end of the load. Anything else is read
+ * a line at a time.
+ */
+static struct lval *lenv_load(struct lenv *e, char *file, int collect)
+{
+	struct lreader r = { .name = file, .s = "", .line = 1, .col = 1 };
+	struct lval *x, *out;
+	FILE *f;
+	char *map;
+	size_t map_len = 0;
+	int i;
+
+	f = strcmp(file, "-") ? fopen(file, "rb") : stdin;
+	if (!f)
+		return lval_err("Could not load %s: error: Unable to open file!",
+				file);
+	map = map_file(f, &map_len);
+	if (map)
+		r.s = map;
+	else
+		r.f = f;
+
+	for (i = 1; (x = lread_next(&r)); i++) {
+		x = lval_eval(e, x);
+		if (ltype(x) == LVAL_ERR) {
+			printf("\nLoad error in %s:%d\n\n", file, i);
+			lval_println(e, x);
+		}
+		lval_free(x);
+
+		/* safe point, nothing but e is live */
+		if (collect && lgc_due())
+			lgc_collect(e, NULL);
+
+		if (map && r.pos >= LOAD_DROP_BYTES) {
+			long n = r.pos & ~(LOAD_DROP_BYTES - 1);
+			lread_count(r.s, n, &r.line, &r.col);
+			madvise((char *)r.s, n, MADV_DONTNEED);
+			r.s += n;
+			r.pos -= n;
+		}
+	}
+
+	if (r.err)
+		out = lval_err("Could not load %s", r.err);
+	else if (ferror(f))
+		out = lval_err("Could not load %s: error: Read failed!", file);
+	else
+		out = lval_sexpr();
+	free(r.err);
+	free(r.buf);
+	if (map)
+		munmap(map, map_len);
+	if (f != stdin)
+		fclose(f);
+	return out;
+}
+
+static struct lval *lenv_load_image(struct lenv *e, char *file)
+{
+	FILE *f = fopen(file, "rb");
+	struct lval *out;
+	char *err;
+
+	if (!f)
+		return lval_err("Could not load image %s: Unable to open file!",
+				file);
+	err = lser_read_image(f, e);
+	fclose(f);
+	if (!err)
+		return lval_sexpr();
+	out = lval_err("Could not load image %s: %s", file, err);
+	free(err);
+	return out;
+}
+
+static struct lval *lenv_write_image(struct lenv *e, char *file)
+{
+	FILE *f = fopen(file, "wb");
+	int failed;
+
+	if (!f)
+		return lval_err("Could not write image %s: Unable to open file!",
+				file);
+	failed = lser_write_image(f, e);
+	failed |= fclose(f);
+	if (failed)
+		return lval_err("Could not write image %s: Write failed!",
+				file);
+	return lval_sexpr();
+}
+
+/* Name of the user function f for messages, functions which were never
+ * bound by def or = are looked up by value, which is slow
+ */
+static const char *lval_fun_name(struct lenv *e, struct lval *f)
+{
+	return f->name ? f->name : lenv_lookup_sym_by_val(e, f);
+}
+
+static char *lenv_lookup_sym_by_val(struct lenv *e, struct lval *a)
+{
+	int i;
+	if (e->scope) {
+		for (i = 0; i < e->scope->count; i++)
+			if (e->slots[i] && lval_eq(e->slots[i], a))
+				return e->scope->syms[i];
+	}
+	i = lenv_get_val_pos(e, a);
+	if (i != -1)
+		return e->syms[i];
+	else if (e->par)
+		return lenv_lookup_sym_by_val(e->par, a);
+	return "\\";
+}
+
+static char *lval_args_to_str(struct lenv *e, struct lval *a)
+{
+	struct lbuf b;
+	int i;
+	lbuf_init(&b, NULL);
+	for (i = 0; i < a->count; i++)
+		lval_write(&b, e, a->cell[i]);
+	return lbuf_take(&b);
+}
+
+static struct lval *builtin_print(struct lenv *e, struct lval *a)
+{
+	struct lbuf b;
+	int i;
+	lbuf_init(&b, stdout);
+	for (i = 0; i < a->count; i++) {
+		lval_write(&b, e, a->cell[i]);
+		lbuf_putc(&b, ' ');
+	}
+	lbuf_putc(&b, '\n');
+	lbuf_flush(&b);
+	lval_free(a);
+	return lval_sexpr();
+}
+
+static struct lval *builtin_error(struct lenv *e, struct lval *a)
+{
+	char fname[] = "error";
+	struct lval *out;
+	if (a->count < 1) {
+		out = lerr_args_too_few_variable(a, fname, 1);
+	} else {
+		char *msg = lval_args_to_str(e, a);
+		out = lval_err("%s", msg);
+		free(msg);
+	}
+	lval_free(a);
+	return out;
+}
+
+/* Operators of the number builtins, see lop_apply() */
+enum {
+	LOP_ADD,
+	LOP_SUB,
+	LOP_MUL,
+	LOP_DIV,
+	LOP_MOD,
+	LOP_AND,
+	LOP_OR,
+	LOP_BAND,
+	LOP_BOR,
+	LOP_XOR,
+	LOP_SHL,
+	LOP_SHR,
+	LOP_GT,
+	LOP_GE,
+	LOP_LT,
+	LOP_LE,
+};
+
+/* *n = *n op m, returns LERR_NONE or why it could not be done
+ *
+ * Arithmetic is checked, results which do not fit a long are an error
+ * instead of wrapping around.
+ */
+static inline int lop_apply(int op, long *n, long m)
+{
+	switch (op) {
+	case LOP_ADD:
+		return __builtin_add_overflow(*n, m, n) ? LERR_OVERFLOW :
+							  LERR_NONE;
+	case LOP_SUB:
+		return __builtin_sub_overflow(*n, m, n) ? LERR_OVERFLOW :
+							  LERR_NONE;
+	case LOP_MUL:
+		return __builtin_mul_overflow(*n, m, n) ? LERR_OVERFLOW :
+							  LERR_NONE;
+	case LOP_DIV:
+		if (m == 0)
+			return LERR_DIV_ZERO;
+		if (*n == LONG_MIN && m == -1)
+			return LERR_OVERFLOW;
+		*n /= m;
+		break;
+	case LOP_MOD:
+		if (m == 0)
+			return LERR_MOD_ZERO;
+		*n = m == -1 ? 0 : *n % m;
+		break;
+	case LOP_AND:
+		*n = *n && m;
+		break;
+	case LOP_OR:
+		*n = *n || m;
+		break;
+	case LOP_BAND:
+		*n &= m;
+		break;
+	case LOP_BOR:
+		*n |= m;
+		break;
+	case LOP_XOR:
+		*n ^= m;
+		break;
+	case LOP_SHL: /* unsigned, bits shifted out are dropped */
+		if (m < 0 || m >= (long)(sizeof(long) * CHAR_BIT))
+			return LERR_SHIFT;
+		*n = (long)((unsigned long)*n << m);
+		break;
+	case LOP_SHR:
+		if (m < 0 || m >= (long)(sizeof(long) * CHAR_BIT))
+			return LERR_SHIFT;
+		*n >>= m;
+		break;
+	case LOP_GT:
+		*n = *n > m;
+		break;
+	case LOP_GE:
+		*n = *n >= m;
+		break;
+	case LOP_LT:
+		*n = *n < m;
+		break;
+	case LOP_LE:
+		*n = *n <= m;
+		break;
+	}
+	return LERR_NONE;
+}
+
+static struct lval *lval_err_num(int err)
+{
+	switch (err) {
+	case LERR_DIV_ZERO:
+		return lval_err("Division By Zero!");
+	case LERR_MOD_ZERO:
+		return lval_err("Modulo By Zero!");
+	case LERR_OVERFLOW:
+		return lval_err("Integer Overflow!");
+	case LERR_SHIFT:
+		return lval_err("Shift Out Of Range!");
+	default:
+		return lval_err("Bad Number!");
+	}
+}
+
+/* Fold the numbers in a with op from left to right, a is consumed
+ *
+ * Always inlined into the builtins below so op is a constant there and the
+ * switch in lop_apply() goes away.
+ */
+static inline __attribute__((always_inline)) struct lval *
+builtin_num_op(struct lenv *e, struct lval *a, const char *fname, int op)
+{
+	struct lval *out;
+	long n;
+	int i, err = LERR_NONE;
+
+	/* (op x y), no type loop */
+	if (a->count == 2 && ltype(a->cell[0]) == LVAL_NUM &&
+	    ltype(a->cell[1]) == LVAL_NUM) {
+		n = lnum(a->cell[0]);
+		err = lop_apply(op, &n, lnum(a->cell[1]));
+		lval_free(a);
+		return err == LERR_NONE ? lval_num(n) : lval_err_num(err);
+	}
+
+	if (a->count == 0) {
+		out = lerr_args_too_few(a, fname, 1);
+		lval_free(a);
+		return out;
+	}
+	for (i = 0; i < a->count; i++) {
+		if (ltype(a->cell[i]) != LVAL_NUM) {
+			out = lerr_args_type(e, a, fname, LVAL_NUM,
+					     ltype(a->cell[i]));
+			lval_free(a);
+			return out;
+		}
+	}
+
+	n = lnum(a->cell[0]);
+
+	/* unary negation */
+	if (op == LOP_SUB && a->count == 1)
+		err = __builtin_sub_overflow(0, n, &n) ? LERR_OVERFLOW :
+							 LERR_NONE;
+
+	for (i = 1; i < a->count && err == LERR_NONE; i++)
+		err = lop_apply(op, &n, lnum(a->cell[i]));
+
+	lval_free(a);
+	return err == LERR_NONE ? lval_num(n) : lval_err_num(err);
+}
+
+/* (op x) for the unary operators ! and ~ */
+static struct lval *builtin_num_unary(struct lenv *e, struct lval *a,
+				      const char *fname, int bitwise)
+{
+	struct lval *out;
+	if (a->count != 1)
+		out = lerr_args_num(a, fname, 1);
+	else if (ltype(a->cell[0]) != LVAL_NUM)
+		out = lerr_args_type(e, a, fname, LVAL_NUM, ltype(a->cell[0]));
+	else
+		out = lval_num(bitwise ? ~lnum(a->cell[0]) : !lnum(a->cell[0]));
+	lval_free(a);
+	return out;
+}
+
+/* (op x y) for the comparisons */
+static inline __attribute__((always_inline)) struct lval *
+builtin_order(struct lenv *e, struct lval *a, const char *fname, int op)
+{
+	struct lval *out;
+	long n;
+	if (a->count != 2)
+		out = lerr_args_num(a, fname, 2);
+	else if (ltype(a->cell[0]) != LVAL_NUM)
+		out = lerr_args_type(e, a, fname, LVAL_NUM, ltype(a->cell[0]));
+	else if (ltype(a->cell[1]) != LVAL_NUM)
+		out = lerr_args_type(e, a, fname, LVAL_NUM, ltype(a->cell[1]));
+	else {
+		n = lnum(a->cell[0]);
+		lop_apply(op, &n, lnum(a->cell[1]));
+		out = lval_num(n);
+	}
+	lval_free(a);
+	return out;
+}
+
+/* Evaluate and compare both arguments for equality.
+ * @param e: env
+ * @param a: lval containing two args for comparison
+ */
+static struct lval *builtin_assert(struct lenv *e, struct lval *a)
+{
+	if (a->count != 2) {
+		struct lval *out = lerr_args_num(a, "assert", 2);
+		lval_free(a);
+		return out;
+	}
+
+	struct lval *ret;
+	if (lval_eq(a->cell[0], a->cell[1])) {
+		ret = lval_num(1);
+	} else {
+		char *expr1 = lval_to_str(e, a->cell[0]);
+		char *expr2 = lval_to_str(e, a->cell[1]);
+		ret = lval_err("assert failed [%s] != [%s]", expr1, expr2);
+		free(expr1);
+		free(expr2);
+	}
+	lval_free(a);
+	return ret;
+}
+
+/* Evaluate and compare both arguments for equality.
+ * @param e: env
+ * @param a: lval containing err and substring match of the error message
+ */
+static struct lval *builtin_assert_err(struct lenv *e, struct lval *a)
+{
+	char fname[] = "assert_err";
+	struct lval *out;
+	if (a->count != 2)
+		out = lerr_args_num(a, fname, 2);
+	else if (ltype(a->cell[0]) != LVAL_ERR)
+		out = lerr_args_type(e, a, fname, LVAL_ERR, ltype(a));
+	else if (ltype(a->cell[1]) != LVAL_CHARBUF)
+		out = lerr_args_type(e, a, fname, LVAL_CHARBUF, ltype(a));
+	else if (!strstr(a->cell[0]->err, lval_cstr(a->cell[1]))) {
+		char *haystack = a->cell[0]->err;
+		char *needle = a->cell[1]->charbuf;
+		out = lval_err("assert failed \"%s\" does not contain \"%s\")",
+			       haystack, needle);
+	} else
+		out = lval_num(1);
+
+	lval_free(a);
+	return out;
+}
+
+static struct lval *builtin_type(struct lenv *e, struct lval *a)
+{
+	char fname[] = "type";
+	struct lval *out;
+	if (a->count != 1) {
+		out = lerr_args_num(a, fname, 1);
+	} else {
+		out = lval_str(ltype_name(ltype(a->cell[0])));
+	}
+	lval_free(a);
+	return out;
+}
+
+/* (gc "stats") returns {collections pause_us max_pause_us freed_bytes
+ * heap_bytes live_bytes}, (gc "collect") collects at the next safe point
+ */
+static struct lval *builtin_gc(struct lenv *e, struct lval *a)
+{
+	char fname[] = "gc";
+	struct lval *out;
+	if (a->count != 1) {
+		out = lerr_args_num(a, fname, 1);
+	} else if (ltype(a->cell[0]) != LVAL_CHARBUF) {
+		out = lerr_args_type(e, a, fname, LVAL_CHARBUF,
+				     ltype(a->cell[0]));
+	} else if (strcmp(lval_cstr(a->cell[0]), "stats") == 0) {
+		struct lgc_stats *s = lgc_stats();
+		out = lval_qexpr();
+		out = lval_add(out, lval_num(s->collections));
+		out = lval_add(out, lval_num(s->pause_us));
+		out = lval_add(out, lval_num(s->max_pause_us));
+		out = lval_add(out, lval_num(s->freed_bytes));
+		out = lval_add(out, lval_num(s->heap_bytes));
+		out = lval_add(out, lval_num(s->live_bytes));
+	} else if (strcmp(a->cell[0]->charbuf, "collect") == 0) {
+		lgc_request();
+		out = lval_sexpr();
+	} else {
+		out = lval_func_err(a, fname,
+				    "expected \"stats\" or \"collect\", "
+				    "received \"%s\"",
+				    a->cell[0]->charbuf);
+	}
+	lval_free(a);
+	return out;
+}
+
+static struct lval *builtin_load(struct lenv *e, struct lval *a)
+{
+	char fname[] = "load";
+	struct lval *out;
+	if (a->count != 1) {
+		out = lerr_args_num(a, fname, 1);
+	} else if (ltype(a->cell[0]) != LVAL_CHARBUF) {
+		out = lerr_args_type(e, a, fname, LVAL_CHARBUF, ltype(a));
+	} else {
+		out = lenv_load(e, lval_cstr(a->cell[0]), 0);
+	}
+	lval_free(a);
+	return out;
+}
+
+/* Data files
+ *
+ * (data-write "file" x ...) replaces the file with the values, data-append
+ * adds them to its end. data-read returns every value in a Q-Expression,
+ * (data-each "file" f) calls f on one value at a time instead so the file
+ * never has to fit in memory. The values are not evaluated again.
+ */
+
+static struct lval *builtin_data_put(struct lenv *e, struct lval *a,
+				     const char *fname, const char *mode)
+{
+	struct lval *out;
+	FILE *f;
+	int i, failed;
+	if (a->count < 1) {
+		out = lerr_args_too_few_variable(a, fname, 1);
+	} else if (ltype(a->cell[0]) != LVAL_CHARBUF) {
+		out = lerr_args_type(e, a, fname, LVAL_CHARBUF,
+				     ltype(a->cell[0]));
+	} else if (!(f = fopen(lval_cstr(a->cell[0]), mode))) {
+		out = lval_err("Could not write data %s: Unable to open file!",
+			       a->cell[0]->charbuf);
+	} else {
+		/* a new or emptied file starts with the header */
+		fseek(f, 0, SEEK_END);
+		failed = ftell(f) == 0 ? lser_write_header(f) : 0;
+		for (i = 1; i < a->count && !failed; i++)
+			failed = lser_write(f, a->cell[i]);
+		failed |= fclose(f);
+		if (failed)
+			out = lval_err("Could not write data %s: Write failed!",
+				       a->cell[0]->charbuf);
+		else
+			out = lval_sexpr();
+	}
+	lval_free(a);
+	return out;
+}
+
+static struct lval *builtin_data_write(struct lenv *e, struct lval *a)
+{
+	return builtin_data_put(e, a, "data-write", "wb");
+}
+
+static struct lval *builtin_data_append(struct lenv *e, struct lval *a)
+{
+	return builtin_data_put(e, a, "data-append", "ab");
+}
+
+/* Read every record of the data file and hand it to f, or add it to the
+ * Q-Expression out when f is NULL
+ */
+static struct lval *lenv_data_read(struct lenv *e, char *file,
+				   struct lval *f, struct lval *out)
+{
+	struct lval *v, *x;
+	FILE *in = fopen(file, "rb");
+	char *err;
+
+	if (!in) {
+		lval_free(out);
+		return lval_err("Could not read data %s: Unable to open file!",
+				file);
+	}
+	err = lser_read_header(in);
+	while (!err && !(err = lser_read(in, &v)) && v) {
+		if (!f) {
+			out = lval_add(out, v);
+			continue;
+		}
+		x = lval_call(e, f, lval_add(lval_sexpr(), v));
+		if (ltype(x) == LVAL_ERR) {
+			lval_free(out);
+			out = x;
+			break;
+		}
+		lval_free(x);
+	}
+	fclose(in);
+	if (err) {
+		lval_free(out);
+		out = lval_err("Could not read data %s: %s", file, err);
+		free(err);
+	}
+	return out;
+}
+
+static struct lval *builtin_data_read(struct lenv *e, struct lval *a)
+{
+	char fname[] = "data-read";
+	struct lval *out;
+	if (a->count != 1)
+		out = lerr_args_num(a, fname, 1);
+	else if (ltype(a->cell[0]) != LVAL_CHARBUF)
+		out = lerr_args_type(e, a, fname, LVAL_CHARBUF,
+				     ltype(a->cell[0]));
+	else
+		out = lenv_data_read(e, lval_cstr(a->cell[0]), NULL,
+				     lval_qexpr());
+	lval_free(a);
+	return out;
+}
+
+static struct lval *builtin_data_each(struct lenv *e, struct lval *a)
+{
+	char fname[] = "data-each";
+	struct lval *out;
+	if (a->count != 2)
+		out = lerr_args_num(a, fname, 2);
+	else if (ltype(a->cell[0]) != LVAL_CHARBUF)
+		out = lerr_args_type(e, a, fname, LVAL_CHARBUF,
+				     ltype(a->cell[0]));
+	else if (ltype(a->cell[1]) != LVAL_FUN &&
+		 ltype(a->cell[1]) != LVAL_FUN_BUILTIN)
+		out = lerr_args_type(e, a, fname, LVAL_FUN, ltype(a->cell[1]));
+	else
+		out = lenv_data_read(e, lval_cstr(a->cell[0]),
+				     a->cell[1],
+				     lval_sexpr());
+	lval_free(a);
+	return out;
+}
+
+/* builtin math ops */
+static struct lval *builtin_add(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "add", LOP_ADD);
+}
+
+static struct lval *builtin_sub(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "sub", LOP_SUB);
+}
+
+static struct lval *builtin_mul(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "mul", LOP_MUL);
+}
+
+static struct lval *builtin_div(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "div", LOP_DIV);
+}
+
+static struct lval *builtin_mod(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "mod", LOP_MOD);
+}
+
+static struct lval *builtin_def(struct lenv *e, struct lval *a)
+{
+	return builtin_var(e, a, "def");
+}
+
+static struct lval *builtin_put(struct lenv *e, struct lval *a)
+{
+	return builtin_var(e, a, "=");
+}
+
+static struct lval *builtin_eq(struct lenv *e, struct lval *a)
+{
+	if (a->count < 2) {
+		struct lval *out = lerr_args_too_few_variable(a, "==", 2);
+		lval_free(a);
+		return out;
+	}
+	int i;
+	int ret;
+	for (i = 0; i < a->count - 1; i++) {
+		ret = lval_eq(a->cell[i], a->cell[i + 1]);
+		if (ret == 0)
+			break;
+	}
+	lval_free(a);
+	return lval_num(ret);
+}
+
+static struct lval *builtin_ne(struct lenv *e, struct lval *a)
+{
+	if (a->count != 2) {
+		struct lval *out = lerr_args_num(a, "!=", 2);
+		lval_free(a);
+		return out;
+	}
+	int ret = !lval_eq(a->cell[0], a->cell[1]);
+	lval_free(a);
+	return lval_num(ret);
+}
+
+static struct lval *builtin_gt(struct lenv *e, struct lval *a)
+{
+	return builtin_order(e, a, ">", LOP_GT);
+}
+
+static struct lval *builtin_ge(struct lenv *e, struct lval *a)
+{
+	return builtin_order(e, a, ">=", LOP_GE);
 }
 
-static char *lenv_lookup_sym_by_val(struct lenv *e, struct lval *a)
+static struct lval *builtin_lt(struct lenv *e, struct lval *a)
 {
-	int i = lenv_get_val_pos(e, a);
-	if (i != -1)
-		return e->syms[i];
-	else if (e->par)
-		return lenv_lookup_sym_by_val(e->par, a);
-	return "\\";
+	return builtin_order(e, a, "<", LOP_LT);
 }
 
-static char *lval_args_to_str(struct lenv *e, struct lval *a)
+static struct lval *builtin_le(struct lenv *e, struct lval *a)
 {
-	char *old_buf, *new_buf;
+	return builtin_order(e, a, "<=", LOP_LE);
+}
 
-	/* initialize empty buffer for first concat */
-	old_buf = xmalloc(1);
-	old_buf[0] = '\0';
+static struct lval *builtin_bitwise_and(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "&", LOP_BAND);
+}
+static struct lval *builtin_bitwise_or(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "|", LOP_BOR);
+}
+static struct lval *builtin_bitwise_not(struct lenv *e, struct lval *a)
+{
+	return builtin_num_unary(e, a, "~", 1);
+}
+static struct lval *builtin_bitwise_left_shift(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "<<", LOP_SHL);
+}
+static struct lval *builtin_bitwise_right_shift(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, ">>", LOP_SHR);
+}
+static struct lval *builtin_bitwise_xor(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "^", LOP_XOR);
+}
 
-	/* append trailing space for all but last element */
-	while (a->count) {
-		struct lval *x = lval_pop(a, 0);
-		char *s = lval_to_str(e, x);
-		new_buf = String("%s%s", old_buf, s);
-		free(old_buf);
-		free(s);
-		free(x);
-		old_buf = new_buf;
-	}
-	return old_buf;
+static struct lval *builtin_or(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "||", LOP_OR);
+}
+static struct lval *builtin_and(struct lenv *e, struct lval *a)
+{
+	return builtin_num_op(e, a, "&&", LOP_AND);
+}
+static struct lval *builtin_not(struct lenv *e, struct lval *a)
+{
+	return builtin_num_unary(e, a, "!", 0);
 }
 
-static struct lval *builtin_print(struct lenv *e, struct lval *a)
+static int lval_eq(struct lval *x, struct lval *y)
 {
 	int i;
-	for (i = 0; i < a->count; i++) {
-		char *val = lval_to_str(e, a->cell[i]);
-		printf("%s ", val);
-		free(val);
+	if (ltype(x) != ltype(y))
+		return 0;
+	switch (ltype(x)) {
+	case LVAL_FUN:
+		return lval_eq(x->formals, y->formals) &&
+		       lval_eq(x->body, y->body);
+	case LVAL_FUN_BUILTIN:
+		return x->builtin == y->builtin;
+	case LVAL_NUM:
+		return lnum(x) == lnum(y);
+	case LVAL_ERR:
+		return strcmp(x->err, y->err) == 0;
+	case LVAL_SYM:
+		return x->sym == y->sym;
+	case LVAL_CHARBUF:
+		return x->charbuf_len == y->charbuf_len &&
+		       memcmp(lval_str_bytes(x), lval_str_bytes(y),
+			      x->charbuf_len) == 0;
+	case LVAL_SEXPR: /* fallthrough */
+	case LVAL_QEXPR:
+		if (x->count != y->count)
+			return 0;
+		for (i = 0; i < x->count; i++) {
+			if (!lval_eq(x->cell[i], y->cell[i]))
+				return 0;
+		}
+		return 1;
+	case LVAL_VEC:
+		return x->vec_len == y->vec_len &&
+		       (!x->vec_len || memcmp(x->vec, y->vec, sizeof(int64_t) *
+							      x->vec_len) == 0);
+	default:
+		return 0;
 	}
-	putchar('\n');
-	lval_free(a);
-	return lval_sexpr();
 }
 
-static struct lval *builtin_error(struct lenv *e, struct lval *a)
+/* builtin q-expr funcs */
+static struct lval *builtin_head(struct lenv *e, struct lval *a)
 {
-	char fname[] = "error";
+	const char fname[] = "head";
 	struct lval *out;
-	if (a->count < 1) {
-		out = lerr_args_too_few_variable(a, fname, 1);
-	} else {
-		char *msg = lval_args_to_str(e, a);
-		out = lval_err(msg);
-		free(msg);
-	}
+	if (a->count != 1)
+		out = lerr_args_too_many(a, fname, 1);
+	else if (ltype(a->cell[0]) != LVAL_QEXPR)
+		out = lerr_args_type(e, a, fname, LVAL_QEXPR, ltype(a->cell[0]));
+	else if (a->cell[0]->count == 0)
+		out = lval_func_err(a, fname, "passed {}");
+	else
+		out = lval_slice(a->cell[0], 0, 1);
 	lval_free(a);
 	return out;
 }
 
-static struct lval *builtin_op(struct lenv *e, struct lval *a, char *fname,
-			       char *op)
+static struct lval *builtin_tail(struct lenv *e, struct lval *a)
 {
-	int i;
-	for (i = 0; i < a->count; i++) {
-		if (a->cell[i]->type != LVAL_NUM) {
-			struct lval *out = lerr_args_type(e, a, fname, LVAL_NUM,
-							  a->cell[i]->type);
-
-			lval_free(a);
-			return out;
-		}
-	}
-
-	struct lval *x = lval_pop(a, 0);
-
-	/* unary negation */
-	if ((strcmp(op, "-") == 0) && a->count == 0) {
-		x->num = -x->num;
-	}
-
-	/* TODO: obvious algorithmic performance opportunities here */
-	while (a->count > 0) {
-		struct lval *y = lval_pop(a, 0);
-
-		if (strcmp(op, "+") == 0)
-			x->num += y->num;
-		if (strcmp(op, "-") == 0)
-			x->num -= y->num;
-		if (strcmp(op, "*") == 0)
-			x->num *= y->num;
-		if (strcmp(op, "/") == 0) {
-			if (y->num == 0) {
-				lval_free(x);
-				lval_free(y);
-				x = lval_err("Division By Zero!");
-				break;
-			}
-			x->num /= y->num;
-		}
-		if (strcmp(op, "%") == 0) {
-			if (y->num == 0) {
-				lval_free(x);
-				lval_free(y);
-				x = lval_err("Modulo By Zero!");
-				break;
-			}
-			x->num %= y->num;
-		}
-		lval_free(y);
-	}
+	const char fname[] = "tail";
+	struct lval *out;
+	if (a->count != 1)
+		out = lerr_args_too_many(a, fname, 1);
+	else if (ltype(a->cell[0]) != LVAL_QEXPR)
+		out = lerr_args_type(e, a, fname, LVAL_QEXPR, ltype(a->cell[0]));
+	else if (a->cell[0]->count == 0)
+		out = lval_func_err(a, fname, "passed {}");
+	else
+		out = lval_slice(a->cell[0], 1, a->cell[0]->count - 1);
 	lval_free(a);
-	return x;
+	return out;
 }
 
-/* Evaluate and compare both arguments for equality.
- * @param e: env
- * @param a: lval containing two args for comparison
- */
-static struct lval *builtin_assert(struct lenv *e, struct lval *a)
+static struct lval *builtin_list(struct lenv *e, struct lval *a)
 {
-	if (a->count != 2) {
-		struct lval *out = lerr_args_num(a, "assert", 2);
-		lval_free(a);
-		return out;
-	}
-
-	struct lval *ret;
-	struct lval *r1 = lval_eval(e, a->cell[0]);
-	struct lval *r2 = lval_eval(e, a->cell[1]);
-	if (lval_eq(r1, r2)) {
-		ret = lval_num(1);
-	} else {
-		char *expr1 = lval_to_str(e, a->cell[0]);
-		char *expr2 = lval_to_str(e, a->cell[1]);
-		ret = lval_err("assert failed [%s] != [%s]", expr1, expr2);
-		free(expr1);
-		free(expr2);
-	}
-	lval_free(a);
-	return ret;
+	a->type = LVAL_QEXPR;
+	return a;
 }
 
-/* Evaluate and compare both arguments for equality.
- * @param e: env
- * @param a: lval containing err and substring match of the error message
+/* Check the arguments of eval, returns the expression to evaluate or an
+ * error. a is consumed.
  */
-static struct lval *builtin_assert_err(struct lenv *e, struct lval *a)
+static struct lval *lval_unquote(struct lenv *e, struct lval *a)
 {
-	char fname[] = "assert_err";
+	const char fname[] = "eval";
 	struct lval *out;
-	if (a->count != 2)
-		out = lerr_args_num(a, fname, 2);
-	else if (a->cell[0]->type != LVAL_ERR)
-		out = lerr_args_type(e, a, fname, LVAL_ERR, a->type);
-	else if (a->cell[1]->type != LVAL_CHARBUF)
-		out = lerr_args_type(e, a, fname, LVAL_CHARBUF, a->type);
-	else if (!strstr(a->cell[0]->err, a->cell[1]->charbuf)) {
-		char *haystack = a->cell[0]->err;
-		char *needle = a->cell[1]->charbuf;
-		out = lval_err("assert failed \"%s\" does not contain \"%s\")",
-			       haystack, needle);
-	} else
-		out = lval_num(1);
-
+	if (a->count != 1)
+		out = lerr_args_too_many(a, fname, 1);
+	else if (ltype(a->cell[0]) != LVAL_QEXPR)
+		out = lerr_args_type(e, a, fname, LVAL_QEXPR, ltype(a->cell[0]));
+	else
+		return lval_take(a, 0);
 	lval_free(a);
 	return out;
 }
 
-static struct lval *builtin_type(struct lenv *e, struct lval *a)
+static struct lval *builtin_eval(struct lenv *e, struct lval *a)
 {
-	char fname[] = "type";
-	struct lval *out;
-	if (a->count != 1) {
-		out = lerr_args_num(a, fname, 1);
-	} else {
-		out = lval_str(ltype_name(a->cell[0]->type));
-	}
-	lval_free(a);
-	return out;
+	return lval_eval_code(e, lval_unquote(e, a), 1);
 }
 
-static struct lval *builtin_load(struct lenv *e, struct lval *a)
+/* Check the arguments of if, returns the branch to evaluate or an error.
+ * a is consumed.
+ */
+static struct lval *lval_if_branch(struct lenv *e, struct lval *a)
 {
-	char fname[] = "load";
+	const char fname[] = "if";
 	struct lval *out;
-	if (a->count != 1) {
-		out = lerr_args_num(a, fname, 1);
-	} else if (a->cell[0]->type != LVAL_CHARBUF) {
-		out = lerr_args_type(e, a, fname, LVAL_CHARBUF, a->type);
-	} else {
-		out = lenv_load(e, a->cell[0]->charbuf);
-	}
+	if (a->count != 3)
+		out = lerr_args_num(a, fname, 3);
+	else if (ltype(a->cell[0]) != LVAL_NUM)
+		out = lerr_args_type(e, a, fname, LVAL_NUM, ltype(a->cell[0]));
+	else if (ltype(a->cell[1]) != LVAL_QEXPR)
+		out = lerr_args_type(e, a, fname, LVAL_QEXPR, ltype(a->cell[1]));
+	else if (ltype(a->cell[2]) != LVAL_QEXPR)
+		out = lerr_args_type(e, a, fname, LVAL_QEXPR, ltype(a->cell[2]));
+	else /* conditionally execute the first or second qexpr */
+		out = lval_pop(a, lnum(a->cell[0]) ? 1 : 2);
 	lval_free(a);
 	return out;
 }
 
-/* builtin math ops */
-static struct lval *builtin_add(struct lenv *e, struct lval *a)
+/* (if condition {execute if cond true} {execute if cond false})
+ *
+ */
+struct lval *builtin_if(struct lenv *e, struct lval *a)
 {
-	return builtin_op(e, a, "add", "+");
+	return lval_eval_code(e, lval_if_branch(e, a), 1);
 }
 
-static struct lval *builtin_sub(struct lenv *e, struct lval *a)
+struct lval *builtin_join(struct lenv *e, struct lval *a)
 {
-	return builtin_op(e, a, "sub", "-");
+	int i;
+	const char fname[] = "join";
+	struct lval *out = NULL;
+	int last_type = ltype(a->cell[0]);
+	for (i = 0; i < a->count; i++) {
+		if (ltype(a->cell[i]) == LVAL_QEXPR) {
+			if (last_type != LVAL_QEXPR) {
+				out = lerr_args_mult_type(a, fname, last_type,
+							  LVAL_QEXPR);
+				break;
+			}
+		} else if (ltype(a->cell[i]) == LVAL_CHARBUF) {
+			if (last_type != LVAL_CHARBUF) {
+				out = lerr_args_mult_type(a, fname, last_type,
+							  LVAL_CHARBUF);
+				break;
+			}
+		} else {
+			out = lerr_args_type_str(e, a, fname,
+						 "Q-Expression or Charbuf",
+						 ltype(a->cell[i]));
+			break;
+		}
+	}
+	if (!out) {
+		if (ltype(a->cell[0]) == LVAL_QEXPR) {
+			out = lval_pop(a, 0);
+			while (a->count)
+				out = lval_join_qexpr(out, lval_pop(a, 0));
+		} else if (ltype(a->cell[0]) == LVAL_CHARBUF) {
+			out = lval_join_charbuf(e, a);
+		} else {
+			out = lval_func_err(
+				a, fname,
+				"Function %s: expected argument types in set(%s, %s), received: %s",
+				fname, ltype_name(LVAL_QEXPR),
+				ltype_name(LVAL_CHARBUF),
+				ltype_name(ltype(a->cell[0])));
+		}
+	}
+	lval_free(a);
+	return out;
 }
 
-static struct lval *builtin_mul(struct lenv *e, struct lval *a)
-{
-	return builtin_op(e, a, "mul", "*");
-}
+/* builtin list funcs
+ *
+ * Native halves of the list functions lib.lsp defines, which stay Lisp
+ * functions so they can be partially applied. Elements handed to a function
+ * or returned by list-nth and list-last are evaluated first, as (first l)
+ * did.
+ */
 
-static struct lval *builtin_div(struct lenv *e, struct lval *a)
+/* Call the function f with the evaluated arguments a, a is consumed */
+static struct lval *lval_call(struct lenv *e, struct lval *f, struct lval *a)
 {
-	return builtin_op(e, a, "div", "/");
+	struct lval *out;
+
+	if (ltype(f) == LVAL_FUN_BUILTIN)
+		return f->builtin(e, a);
+	if (ltype(f) != LVAL_FUN) {
+		out = lerr_args_type(e, f, "eval_sexpr", LVAL_FUN, ltype(f));
+		lval_free(a);
+		return out;
+	}
+
+	/* error or partial */
+	f = lval_bind(e, f, a);
+	if (ltype(f) != LVAL_FUN || f->formals)
+		return f;
+
+	f->env->par = e;
+	if (engine == ENGINE_VM) {
+		out = lvm_eval(f->env, lval_ref(f->body));
+	} else {
+		out = lval_eval_code(f->env, lval_ref(f->body), 1);
+	}
+	lval_free(f);
+	return out;
 }
 
-static struct lval *builtin_mod(struct lenv *e, struct lval *a)
+/* call f with the value of the list element x and y if not NULL */
+static struct lval *lval_call_elem(struct lenv *e, struct lval *f,
+				   struct lval *y, struct lval *x)
 {
-	return builtin_op(e, a, "mod", "%");
+	struct lval *a = lval_sexpr();
+	if (y)
+		a = lval_add(a, y);
+	a = lval_add(a, lval_eval(e, lval_ref(x)));
+	return lval_call(e, f, a);
 }
 
-static struct lval *builtin_def(struct lenv *e, struct lval *a)
+/* Check the arguments of (fname x... l) with the list l last of count, NULL
+ * if they are fine
+ */
+static struct lval *lval_check_list(struct lenv *e, struct lval *a,
+				    const char *fname, int count)
 {
-	return builtin_var(e, a, "def");
+	if (a->count != count)
+		return lerr_args_num(a, fname, count);
+	if (ltype(a->cell[count - 1]) != LVAL_QEXPR)
+		return lerr_args_type(e, a, fname, LVAL_QEXPR,
+				      ltype(a->cell[count - 1]));
+	return NULL;
 }
 
-static struct lval *builtin_put(struct lenv *e, struct lval *a)
+/* Check (fname n l) with n an index into l or, with end set, at most its
+ * length
+ */
+static struct lval *lval_check_index(struct lenv *e, struct lval *a,
+				     const char *fname, int end)
 {
-	return builtin_var(e, a, "=");
+	struct lval *out = lval_check_list(e, a, fname, 2);
+	long n, len;
+	if (out)
+		return out;
+	if (ltype(a->cell[0]) != LVAL_NUM)
+		return lerr_args_type(e, a, fname, LVAL_NUM, ltype(a->cell[0]));
+	n = lnum(a->cell[0]);
+	len = a->cell[1]->count;
+	if (end && (n < 0 || n > len))
+		return lval_func_err(a, fname,
+				     "passed %ld element(s), list has %ld", n,
+				     len);
+	if (!end && (n < 0 || n >= len))
+		return lval_func_err(a, fname,
+				     "passed index %ld, list has %ld element(s)",
+				     n, len);
+	return NULL;
 }
 
-static struct lval *builtin_eq(struct lenv *e, struct lval *a)
+static struct lval *builtin_list_len(struct lenv *e, struct lval *a)
 {
-	if (a->count < 2) {
-		lval_free(a);
-		return lerr_args_too_few_variable(a, "==", 2);
-	}
-	int i;
-	int ret;
-	for (i = 0; i < a->count - 1; i++) {
-		ret = lval_eq(a->cell[i], a->cell[i + 1]);
-		if (ret == 0)
-			break;
-	}
+	struct lval *out = lval_check_list(e, a, "list-len", 1);
+	if (!out)
+		out = lval_num(a->cell[0]->count);
+	lval_free(a);
+	return out;
+}
+
+static struct lval *builtin_list_nth(struct lenv *e, struct lval *a)
+{
+	struct lval *out = lval_check_index(e, a, "list-nth", 0);
+	if (!out)
+		out = lval_eval(e, lval_ref(a->cell[1]->cell[lnum(a->cell[0])]));
 	lval_free(a);
-	return lval_num(ret);
+	return out;
 }
 
-static struct lval *builtin_ne(struct lenv *e, struct lval *a)
+static struct lval *builtin_list_last(struct lenv *e, struct lval *a)
 {
-	if (a->count != 2) {
-		lval_free(a);
-		return lerr_args_num(a, "!=", 2);
-	}
-	int ret = !lval_eq(a->cell[0], a->cell[1]);
+	const char fname[] = "list-last";
+	struct lval *out = lval_check_list(e, a, fname, 1);
+	struct lval *l = a->cell[0];
+	if (!out && !l->count)
+		out = lval_func_err(a, fname, "passed {}");
+	if (!out)
+		out = lval_eval(e, lval_ref(l->cell[l->count - 1]));
 	lval_free(a);
-	return lval_num(ret);
+	return out;
 }
 
-static struct lval *builtin_gt(struct lenv *e, struct lval *a)
+static struct lval *builtin_list_take(struct lenv *e, struct lval *a)
 {
-	return builtin_order(e, a, ">");
+	struct lval *out = lval_check_index(e, a, "list-take", 1);
+	if (!out)
+		out = lval_slice(a->cell[1], 0, lnum(a->cell[0]));
+	lval_free(a);
+	return out;
 }
 
-static struct lval *builtin_ge(struct lenv *e, struct lval *a)
+static struct lval *builtin_list_drop(struct lenv *e, struct lval *a)
 {
-	return builtin_order(e, a, ">=");
+	struct lval *out = lval_check_index(e, a, "list-drop", 1);
+	if (!out) {
+		long n = lnum(a->cell[0]);
+		out = lval_slice(a->cell[1], n, a->cell[1]->count - n);
+	}
+	lval_free(a);
+	return out;
 }
 
-static struct lval *builtin_lt(struct lenv *e, struct lval *a)
+static struct lval *builtin_list_split(struct lenv *e, struct lval *a)
 {
-	return builtin_order(e, a, "<");
+	struct lval *out = lval_check_index(e, a, "list-split", 1);
+	if (!out) {
+		long n = lnum(a->cell[0]);
+		struct lval *l = a->cell[1];
+		out = lval_qexpr();
+		out = lval_add(out, lval_slice(l, 0, n));
+		out = lval_add(out, lval_slice(l, n, l->count - n));
+	}
+	lval_free(a);
+	return out;
 }
 
-static struct lval *builtin_le(struct lenv *e, struct lval *a)
+static struct lval *builtin_list_map(struct lenv *e, struct lval *a)
 {
-	return builtin_order(e, a, "<=");
+	struct lval *out = lval_check_list(e, a, "list-map", 2);
+	int i;
+	if (!out) {
+		struct lval *f = a->cell[0], *l = a->cell[1];
+		out = lval_qexpr();
+		lval_reserve(out, 0, l->count);
+		for (i = 0; i < l->count; i++)
+			out = lval_add(out,
+				       lval_call_elem(e, f, NULL, l->cell[i]));
+	}
+	lval_free(a);
+	return out;
 }
 
-static struct lval *builtin_order(struct lenv *e, struct lval *a, char *op)
+/* (list-filter f l) keeps the elements of l, not their values, for which f
+ * returns a true number. f runs on each element in turn and an error it
+ * returns is the result.
+ */
+static struct lval *builtin_list_filter(struct lenv *e, struct lval *a)
 {
-	struct lval *out;
-	if (a->count != 2)
-		out = lerr_args_num(a, op, 2);
-	else if (a->cell[0]->type != LVAL_NUM)
-		out = lerr_args_type(e, a, op, LVAL_NUM, a->type);
-	else if (a->cell[1]->type != LVAL_NUM)
-		out = lerr_args_type(e, a, op, LVAL_NUM, a->type);
-	else {
-		int num1 = a->cell[0]->num;
-		int num2 = a->cell[1]->num;
-		int ret;
-		if (strcmp(">", op) == 0) {
-			ret = (num1 > num2);
-		} else if (strcmp(">=", op) == 0) {
-			ret = (num1 >= num2);
-		} else if (strcmp("<", op) == 0) {
-			ret = (num1 < num2);
-		} else if (strcmp("<=", op) == 0) {
-			ret = (num1 <= num2);
-		} else {
-			die("comparison op is not a member of set(>, >=, <, <=), received %s",
-			    op);
+	const char fname[] = "list-filter";
+	struct lval *out = lval_check_list(e, a, fname, 2);
+	struct lval *f, *l, *k;
+	int i;
+	if (out) {
+		lval_free(a);
+		return out;
+	}
+	f = a->cell[0];
+	l = a->cell[1];
+	out = lval_qexpr();
+	for (i = 0; i < l->count; i++) {
+		k = lval_call_elem(e, f, NULL, l->cell[i]);
+		if (ltype(k) != LVAL_NUM) {
+			lval_free(out);
+			if (ltype(k) == LVAL_ERR) {
+				out = k;
+			} else {
+				out = lval_func_err(
+					a, fname,
+					"passed a function returning %s, expected %s",
+					ltype_name(ltype(k)), ltype_name(LVAL_NUM));
+				lval_free(k);
+			}
+			break;
 		}
-		out = lval_num(ret);
+		if (lnum(k))
+			out = lval_add(out, lval_ref(l->cell[i]));
+		lval_free(k);
 	}
 	lval_free(a);
 	return out;
 }
 
-static struct lval *builtin_logical(struct lenv *e, struct lval *a, char *op)
+static struct lval *builtin_list_foldl(struct lenv *e, struct lval *a)
 {
+	struct lval *out = lval_check_list(e, a, "list-foldl", 3);
 	int i;
-	for (i = 0; i < a->count; i++) {
-		if (a->cell[i]->type != LVAL_NUM) {
-			char *val = lval_to_str(e, a->cell[i]);
-			struct lval *out = lerr_args_type(e, a, op, LVAL_NUM,
-							  a->cell[i]->type);
-			lval_free(a);
-			free(val);
-			return out;
-		}
+	if (!out) {
+		struct lval *f = a->cell[0], *l = a->cell[2];
+		out = lval_ref(a->cell[1]);
+		for (i = 0; i < l->count; i++)
+			out = lval_call_elem(e, f, out, l->cell[i]);
 	}
+	lval_free(a);
+	return out;
+}
 
-	struct lval *x = lval_pop(a, 0);
+/* builtin vector funcs
+ *
+ * Vectors are packed arrays of numbers for bulk arithmetic, the work is
+ * done by the kernels in lvec.c. Unlike +, - and * the elementwise
+ * arithmetic, vec-sum and vec-dot wrap around instead of reporting overflow.
+ */
 
-	/* not */
-	if (strcmp(op, "!") == 0) {
-		if (a->count == 0) {
-			x->num = !x->num;
+static struct lval *builtin_vec(struct lenv *e, struct lval *a)
+{
+	const char fname[] = "vec";
+	struct lval *out, *l;
+	long i;
+	if (a->count != 1)
+		out = lerr_args_num(a, fname, 1);
+	else if (ltype(a->cell[0]) != LVAL_QEXPR)
+		out = lerr_args_type(e, a, fname, LVAL_QEXPR, ltype(a->cell[0]));
+	else {
+		l = a->cell[0];
+		for (i = 0; i < l->count; i++)
+			if (ltype(l->cell[i]) != LVAL_NUM)
+				break;
+		if (i < l->count) {
+			out = lerr_args_type(e, a, fname, LVAL_NUM,
+					     ltype(l->cell[i]));
 		} else {
-			struct lval *err = lerr_args_too_many(a, op, 0);
-			lval_free(a);
-			return err;
+			out = lval_vec(l->count);
+			for (i = 0; i < l->count; i++)
+				out->vec[i] = lnum(l->cell[i]);
 		}
 	}
+	lval_free(a);
+	return out;
+}
 
-	/* TODO: obvious algorithmic performance opportunities here */
-	while (a->count > 0) {
-		struct lval *y = lval_pop(a, 0);
+/* Check the arguments of (fname v), NULL if they are fine */
+static struct lval *lval_check_vec(struct lenv *e, struct lval *a,
+				   const char *fname)
+{
+	if (a->count != 1)
+		return lerr_args_num(a, fname, 1);
+	if (ltype(a->cell[0]) != LVAL_VEC)
+		return lerr_args_type(e, a, fname, LVAL_VEC, ltype(a->cell[0]));
+	return NULL;
+}
 
-		if (strcmp(op, "&&") == 0)
-			x->num = x->num && y->num;
-		if (strcmp(op, "||") == 0)
-			x->num = x->num || y->num;
-		lval_free(y);
+static struct lval *builtin_vec_list(struct lenv *e, struct lval *a)
+{
+	struct lval *out = lval_check_vec(e, a, "vec-list");
+	long i;
+	if (!out) {
+		struct lval *v = a->cell[0];
+		out = lval_qexpr();
+		lval_reserve(out, 0, v->vec_len);
+		for (i = 0; i < v->vec_len; i++)
+			out = lval_add(out, lval_num(v->vec[i]));
 	}
 	lval_free(a);
-	return x;
+	return out;
 }
 
-static struct lval *builtin_bitwise(struct lenv *e, struct lval *a, char *op)
+static struct lval *builtin_vec_len(struct lenv *e, struct lval *a)
 {
-	int i;
-	for (i = 0; i < a->count; i++) {
-		if (a->cell[i]->type != LVAL_NUM) {
-			struct lval *out = lerr_args_type(e, a, op, LVAL_NUM,
-							  a->cell[i]->type);
-			lval_free(a);
-			return out;
-		}
-	}
+	struct lval *out = lval_check_vec(e, a, "vec-len");
+	if (!out)
+		out = lval_num(a->cell[0]->vec_len);
+	lval_free(a);
+	return out;
+}
 
-	struct lval *x = lval_pop(a, 0);
+/* (fname v) is k over the elements of v, with nonempty v must not be [] */
+static struct lval *builtin_vec_reduce(struct lenv *e, struct lval *a,
+				       const char *fname,
+				       int64_t (*k)(const int64_t *, long),
+				       int nonempty)
+{
+	struct lval *out = lval_check_vec(e, a, fname);
+	if (!out) {
+		struct lval *v = a->cell[0];
+		if (nonempty && v->vec_len == 0)
+			out = lval_func_err(a, fname, "passed []");
+		else
+			out = lval_num(k(v->vec, v->vec_len));
+	}
+	lval_free(a);
+	return out;
+}
 
-	/* one's complement negation */
-	if ((strcmp(op, "~") == 0)) {
-		if (a->count == 0) {
-			x->num = ~x->num;
-		} else {
-			struct lval *err = lerr_args_too_many(a, op, 0);
-			lval_free(a);
-			return err;
-		}
+/* Check the arguments of (fname x y): two vectors of the same length, or a
+ * vector and a number. NULL if they are fine.
+ */
+static struct lval *lval_check_vec2(struct lenv *e, struct lval *a,
+				    const char *fname)
+{
+	int i, vecs = 0;
+	if (a->count != 2)
+		return lerr_args_num(a, fname, 2);
+	for (i = 0; i < 2; i++) {
+		if (ltype(a->cell[i]) == LVAL_VEC)
+			vecs++;
+		else if (ltype(a->cell[i]) != LVAL_NUM)
+			return lerr_args_type(e, a, fname, LVAL_VEC,
+					      ltype(a->cell[i]));
 	}
+	if (!vecs)
+		return lerr_args_type(e, a, fname, LVAL_VEC, LVAL_NUM);
+	if (vecs == 2 && a->cell[0]->vec_len != a->cell[1]->vec_len)
+		return lval_func_err(a, fname,
+				     "passed vectors of length %ld and %ld",
+				     a->cell[0]->vec_len, a->cell[1]->vec_len);
+	return NULL;
+}
+
+/* x as a vector of n elements, a number is repeated */
+static struct lval *lval_vec_operand(struct lval *x, long n)
+{
+	struct lval *v;
+	long i;
+	if (ltype(x) == LVAL_VEC)
+		return lval_ref(x);
+	v = lval_vec(n);
+	for (i = 0; i < n; i++)
+		v->vec[i] = lnum(x);
+	return v;
+}
 
-	/* TODO: obvious algorithmic performance opportunities here */
-	while (a->count > 0) {
-		struct lval *y = lval_pop(a, 0);
-
-		if (strcmp(op, "&") == 0)
-			x->num = x->num & y->num;
-		if (strcmp(op, "|") == 0)
-			x->num = x->num | y->num;
-		if (strcmp(op, "<<") == 0)
-			x->num = x->num << y->num;
-		if (strcmp(op, ">>") == 0)
-			x->num = x->num >> y->num;
-		if (strcmp(op, "^") == 0)
-			x->num = x->num ^ y->num;
+/* (fname x y) is the elementwise k of x and y, or of y and x with swap */
+static struct lval *builtin_vec_map2(struct lenv *e, struct lval *a,
+				     const char *fname,
+				     void (*k)(int64_t *, const int64_t *,
+					       const int64_t *, long),
+				     int swap)
+{
+	struct lval *out = lval_check_vec2(e, a, fname);
+	if (!out) {
+		long n = ltype(a->cell[0]) == LVAL_VEC ? a->cell[0]->vec_len :
+							 a->cell[1]->vec_len;
+		struct lval *x = lval_vec_operand(a->cell[swap], n);
+		struct lval *y = lval_vec_operand(a->cell[!swap], n);
+		out = lval_vec(n);
+		k(out->vec, x->vec, y->vec, n);
+		lval_free(x);
 		lval_free(y);
 	}
 	lval_free(a);
-	return x;
+	return out;
 }
 
-static struct lval *builtin_bitwise_and(struct lenv *e, struct lval *a)
-{
-	return builtin_bitwise(e, a, "&");
-}
-static struct lval *builtin_bitwise_or(struct lenv *e, struct lval *a)
+static struct lval *builtin_vec_add(struct lenv *e, struct lval *a)
 {
-	return builtin_bitwise(e, a, "|");
+	return builtin_vec_map2(e, a, "vec+", lvec_add, 0);
 }
-static struct lval *builtin_bitwise_not(struct lenv *e, struct lval *a)
+
+static struct lval *builtin_vec_sub(struct lenv *e, struct lval *a)
 {
-	return builtin_bitwise(e, a, "~");
+	return builtin_vec_map2(e, a, "vec-", lvec_sub, 0);
 }
-static struct lval *builtin_bitwise_left_shift(struct lenv *e, struct lval *a)
+
+static struct lval *builtin_vec_mul(struct lenv *e, struct lval *a)
 {
-	return builtin_bitwise(e, a, "<<");
+	return builtin_vec_map2(e, a, "vec*", lvec_mul, 0);
 }
-static struct lval *builtin_bitwise_right_shift(struct lenv *e, struct lval *a)
+
+static struct lval *builtin_vec_eq(struct lenv *e, struct lval *a)
 {
-	return builtin_bitwise(e, a, ">>");
+	return builtin_vec_map2(e, a, "vec==", lvec_eq, 0);
 }
-static struct lval *builtin_bitwise_xor(struct lenv *e, struct lval *a)
+
+static struct lval *builtin_vec_gt(struct lenv *e, struct lval *a)
 {
-	return builtin_bitwise(e, a, "^");
+	return builtin_vec_map2(e, a, "vec>", lvec_gt, 0);
 }
 
-static struct lval *builtin_or(struct lenv *e, struct lval *a)
+static struct lval *builtin_vec_lt(struct lenv *e, struct lval *a)
 {
-	return builtin_logical(e, a, "||");
+	return builtin_vec_map2(e, a, "vec<", lvec_gt, 1);
 }
-static struct lval *builtin_and(struct lenv *e, struct lval *a)
+
+static struct lval *builtin_vec_sum(struct lenv *e, struct lval *a)
 {
-	return builtin_logical(e, a, "&&");
+	return builtin_vec_reduce(e, a, "vec-sum", lvec_sum, 0);
 }
-static struct lval *builtin_not(struct lenv *e, struct lval *a)
+
+static struct lval *builtin_vec_min(struct lenv *e, struct lval *a)
 {
-	return builtin_logical(e, a, "!");
+	return builtin_vec_reduce(e, a, "vec-min", lvec_min, 1);
 }
 
-static int lval_eq(struct lval *x, struct lval *y)
+static struct lval *builtin_vec_max(struct lenv *e, struct lval *a)
 {
-	int i;
-	if (x->type != y->type)
-		return 0;
-	switch (x->type) {
-	case LVAL_FUN:
-		if (x->builtin || y->builtin)
-			return x->builtin == y->builtin;
-		else {
-			return lval_eq(x->formals, y->formals) &&
-			       lval_eq(x->body, y->body);
-		}
-	case LVAL_NUM:
-		return x->num == y->num;
-	case LVAL_ERR:
-		return strcmp(x->err, y->err) == 0;
-	case LVAL_SYM:
-		return strcmp(x->sym, y->sym) == 0;
-	case LVAL_CHARBUF:
-		return strcmp(x->charbuf, y->charbuf) == 0;
-	case LVAL_SEXPR: /* fallthrough */
-	case LVAL_QEXPR:
-		if (x->count != y->count)
-			return 0;
-		for (i = 0; i < x->count; i++) {
-			if (!lval_eq(x->cell[i], y->cell[i]))
-				return 0;
-		}
-		return 1;
-	default:
-		return 0;
-	}
+	return builtin_vec_reduce(e, a, "vec-max", lvec_max, 1);
 }
 
-/* builtin q-expr funcs */
-static struct lval *builtin_head(struct lenv *e, struct lval *a)
+static struct lval *builtin_vec_dot(struct lenv *e, struct lval *a)
 {
-	const char fname[] = "head";
-	struct lval *out;
-	if (a->count != 1)
-		out = lerr_args_too_many(a, fname, 1);
-	else if (a->cell[0]->type != LVAL_QEXPR)
-		out = lerr_args_type(e, a, fname, LVAL_QEXPR, a->cell[0]->type);
-	else if (a->cell[0]->count == 0)
-		out = lval_func_err(a, fname, "passed {}");
-	else {
-		/* a freed in lval_take */
-		out = lval_take(a, 0);
-		while (out->count > 1)
-			lval_free(lval_pop(out, 1));
-		return out;
+	const char fname[] = "vec-dot";
+	struct lval *out = lval_check_vec2(e, a, fname);
+	if (!out) {
+		long n = ltype(a->cell[0]) == LVAL_VEC ? a->cell[0]->vec_len :
+							 a->cell[1]->vec_len;
+		struct lval *x = lval_vec_operand(a->cell[0], n);
+		struct lval *y = lval_vec_operand(a->cell[1], n);
+		out = lval_num(lvec_dot(x->vec, y->vec, n));
+		lval_free(x);
+		lval_free(y);
 	}
 	lval_free(a);
 	return out;
 }
 
-static struct lval *builtin_tail(struct lenv *e, struct lval *a)
+/* (vec-isa name) switches the vector builtins to the instruction set
+ * "scalar", "sse2" or "avx2" if the CPU has it, "" keeps the current one.
+ * Returns the name of the one in use.
+ */
+static struct lval *builtin_vec_isa(struct lenv *e, struct lval *a)
 {
-	const char fname[] = "tail";
+	const char fname[] = "vec-isa";
 	struct lval *out;
+	char *name;
+	int isa;
 	if (a->count != 1)
-		out = lerr_args_too_many(a, fname, 1);
-	else if (a->cell[0]->type != LVAL_QEXPR)
-		out = lerr_args_type(e, a, fname, LVAL_QEXPR, a->cell[0]->type);
-	else if (a->cell[0]->count == 0)
-		out = lval_func_err(a, fname, "passed {}");
+		out = lerr_args_num(a, fname, 1);
+	else if (ltype(a->cell[0]) != LVAL_CHARBUF)
+		out = lerr_args_type(e, a, fname, LVAL_CHARBUF, ltype(a->cell[0]));
 	else {
-		/* a freed in lval_take */
-		out = lval_take(a, 0);
-		lval_free(lval_pop(out, 0));
-		return out;
+		name = lval_cstr(a->cell[0]);
+		isa = *name ? lvec_isa_by_name(name) : lvec_isa();
+		if (isa < 0 || !lvec_isa_supported(isa)) {
+			out = lval_func_err(a, fname, "%s is not supported",
+					    name);
+		} else {
+			lvec_set_isa(isa);
+			out = lval_str((char *)lvec_isa_name(isa));
+		}
 	}
 	lval_free(a);
 	return out;
 }
 
-static struct lval *builtin_list(struct lenv *e, struct lval *a)
+/* Charbufs
+ *
+ * Like nth and take the numbers come first. (str-byte i s) is the byte at i
+ * as a number from 0 to 255, (str-slice start n s) the n bytes from start.
+ * A slice shares the bytes of s instead of copying them, which also keeps
+ * all of s alive.
+ */
+
+/* Check the arguments of (fname x... s) with nums numbers x, NULL if they
+ * are fine
+ */
+static struct lval *lval_check_str(struct lenv *e, struct lval *a,
+				   const char *fname, int nums)
 {
-	a->type = LVAL_QEXPR;
-	return a;
+	int i;
+	if (a->count != nums + 1)
+		return lerr_args_num(a, fname, nums + 1);
+	for (i = 0; i < nums; i++)
+		if (ltype(a->cell[i]) != LVAL_NUM)
+			return lerr_args_type(e, a, fname, LVAL_NUM,
+					      ltype(a->cell[i]));
+	if (ltype(a->cell[nums]) != LVAL_CHARBUF)
+		return lerr_args_type(e, a, fname, LVAL_CHARBUF,
+				      ltype(a->cell[nums]));
+	return NULL;
 }
 
-static struct lval *builtin_eval(struct lenv *e, struct lval *a)
+static struct lval *builtin_str_len(struct lenv *e, struct lval *a)
 {
-	const char fname[] = "eval";
-	struct lval *out;
-	if (a->count != 1)
-		out = lerr_args_too_many(a, fname, 1);
-	else if (a->cell[0]->type != LVAL_QEXPR)
-		out = lerr_args_type(e, a, fname, LVAL_QEXPR, a->cell[0]->type);
-	else {
-		/* a freed in lval_take */
-		out = lval_take(a, 0);
-		out->type = LVAL_SEXPR;
-		return lval_eval(e, out);
-	}
+	struct lval *out = lval_check_str(e, a, "str-len", 0);
+	if (!out)
+		out = lval_num(a->cell[0]->charbuf_len);
 	lval_free(a);
 	return out;
 }
 
-/* (if condition {execute if cond true} {execute if cond false})
- *
- */
-static struct lval *builtin_if(struct lenv *e, struct lval *a)
+static struct lval *builtin_str_byte(struct lenv *e, struct lval *a)
 {
-	const char fname[] = "if";
-	struct lval *out;
-	if (a->count != 3)
-		out = lerr_args_num(a, fname, 3);
-	else if (a->cell[0]->type != LVAL_NUM)
-		out = lerr_args_type(e, a, fname, LVAL_NUM, a->cell[0]->type);
-	else if (a->cell[1]->type != LVAL_QEXPR)
-		out = lerr_args_type(e, a, fname, LVAL_QEXPR, a->cell[1]->type);
-	else if (a->cell[2]->type != LVAL_QEXPR)
-		out = lerr_args_type(e, a, fname, LVAL_QEXPR, a->cell[2]->type);
-	else {
-		a->cell[1]->type = LVAL_SEXPR;
-		a->cell[2]->type = LVAL_SEXPR;
-
-		/* conditionally execute the first or second qexpr*/
-		if (a->cell[0]->num)
-			out = lval_eval(e, lval_pop(a, 1));
+	const char fname[] = "str-byte";
+	struct lval *out = lval_check_str(e, a, fname, 1);
+	long i;
+	if (!out) {
+		i = lnum(a->cell[0]);
+		if (i < 0 || i >= a->cell[1]->charbuf_len)
+			out = lval_func_err(
+				a, fname, "passed index %ld, charbuf has %ld byte(s)",
+				i, a->cell[1]->charbuf_len);
 		else
-			out = lval_eval(e, lval_pop(a, 2));
+			out = lval_num((unsigned char)lval_str_bytes(a->cell[1])[i]);
 	}
 	lval_free(a);
 	return out;
 }
 
-struct lval *builtin_join(struct lenv *e, struct lval *a)
+static struct lval *builtin_str_slice(struct lenv *e, struct lval *a)
 {
-	int i;
-	const char fname[] = "join";
-	struct lval *out = NULL;
-	int last_type = a->cell[0]->type;
-	for (i = 0; i < a->count; i++) {
-		if (a->cell[i]->type == LVAL_QEXPR) {
-			if (last_type != LVAL_QEXPR) {
-				out = lerr_args_mult_type(a, fname, last_type,
-							  LVAL_QEXPR);
-				break;
-			}
-		} else if (a->cell[i]->type == LVAL_CHARBUF) {
-			if (last_type != LVAL_CHARBUF) {
-				out = lerr_args_mult_type(a, fname, last_type,
-							  LVAL_CHARBUF);
-				break;
-			}
-		} else {
-			out = lerr_args_type_str(e, a, fname,
-						 "Q-Expression or Charbuf",
-						 a->cell[i]->type);
-			break;
-		}
-	}
+	const char fname[] = "str-slice";
+	struct lval *out = lval_check_str(e, a, fname, 2);
+	long start, n, len;
 	if (!out) {
-		if (a->cell[0]->type == LVAL_QEXPR) {
-			out = lval_pop(a, 0);
-			while (a->count)
-				out = lval_join_qexpr(out, lval_pop(a, 0));
-		} else if (a->cell[0]->type == LVAL_CHARBUF) {
-			out = lval_join_charbuf(e, a);
-		} else {
+		start = lnum(a->cell[0]);
+		n = lnum(a->cell[1]);
+		len = a->cell[2]->charbuf_len;
+		if (start < 0 || n < 0 || start > len || n > len - start)
 			out = lval_func_err(
 				a, fname,
-				"Function %s: expected argument types in set(%s, %s), received: %s",
-				fname, ltype_name(LVAL_QEXPR),
-				ltype_name(LVAL_CHARBUF),
-				ltype_name(a->cell[0]->type));
-		}
+				"passed %ld byte(s) from %ld, charbuf has %ld",
+				n, start, len);
+		else if (n == len)
+			out = lval_ref(a->cell[2]);
+		else
+			out = lval_str_view(a->cell[2], start, n);
 	}
 	lval_free(a);
 	return out;
@@ -1437,14 +3489,14 @@ static struct lval *lerr_verify_first_arg_is_qexpr_of_symbols(struct lenv *e,
 	int i;
 	/* first arg is symbol list */
 	struct lval *syms = a->cell[0];
-	if (a->cell[0]->type != LVAL_QEXPR)
+	if (ltype(a->cell[0]) != LVAL_QEXPR)
 		return lerr_args_type(e, a, fname, LVAL_QEXPR,
-				      a->cell[0]->type);
+				      ltype(a->cell[0]));
 
 	for (i = 0; i < syms->count; i++)
-		if (syms->cell[i]->type != LVAL_SYM)
+		if (ltype(syms->cell[i]) != LVAL_SYM)
 			return lerr_args_type(e, a, fname, LVAL_SYM,
-					      syms->cell[i]->type);
+					      ltype(syms->cell[i]));
 	return NULL;
 }
 
@@ -1474,6 +3526,16 @@ static struct lval *builtin_var(struct lenv *e, struct lval *a, char *fname)
 		return tmp;
 	}
 
+	/* a function keeps the first name it is bound to, one still referred
+	 * to elsewhere is copied so only the binding gets the name
+	 */
+	for (i = 1; i < a->count; i++) {
+		if (ltype(a->cell[i]) == LVAL_FUN && !a->cell[i]->name) {
+			a->cell[i] = lval_cow(a->cell[i]);
+			a->cell[i]->name = syms->cell[i - 1]->sym;
+		}
+	}
+
 	/* assign copies of values to symbols */
 	if (strcmp(fname, "def") == 0)
 		for (i = 0; i < syms->count; i++)
@@ -1493,8 +3555,8 @@ static struct lval *builtin_lambda(struct lenv *e, struct lval *a)
 	struct lval *out = NULL;
 	if (a->count != 2)
 		out = lerr_args_num(a, fname, 2);
-	else if (a->cell[1]->type != LVAL_QEXPR)
-		out = lerr_args_type(e, a, fname, LVAL_QEXPR, a->cell[1]->type);
+	else if (ltype(a->cell[1]) != LVAL_QEXPR)
+		out = lerr_args_type(e, a, fname, LVAL_QEXPR, ltype(a->cell[1]));
 	else
 		out = lerr_verify_first_arg_is_qexpr_of_symbols(e, a, fname);
 	if (!out) {
@@ -1502,7 +3564,13 @@ static struct lval *builtin_lambda(struct lenv *e, struct lval *a)
 		struct lval *formals = lval_pop(a, 0);
 		struct lval *body = lval_pop(a, 0);
 		lval_free(a);
-		return lval_lambda(formals, body);
+
+		/* lexical addresses for references to formals */
+		struct lscope *scope = lscope_new(formals, e->scope);
+		body = lval_resolve(body, scope);
+		out = lval_lambda(formals, body, scope);
+		lscope_free(scope);
+		return out;
 	}
 	lval_free(a);
 	return out;
@@ -1527,82 +3595,117 @@ char *ltype_name(int t)
 		return "S-expression";
 	case LVAL_QEXPR:
 		return "Q-expression";
+	case LVAL_VEC:
+		return "Vector";
 	default: /* leak, but this should never happen */
 		return String("Unknown: %d", t);
 	}
 }
 
+static void usage(char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-e tree|vm] [-g bytes] [-i image] [-w image] "
+		"[file|- ...]\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
 int main(int argc, char *argv[])
 {
-	int i;
+	int i, opt;
+	char *image_in = NULL, *image_out = NULL;
+	struct lval *x;
+
+	while ((opt = getopt(argc, argv, "e:g:i:w:h")) != -1) {
+		switch (opt) {
+		case 'e':
+			if (strcmp(optarg, "tree") == 0)
+				engine = ENGINE_TREE;
+			else if (strcmp(optarg, "vm") == 0)
+				engine = ENGINE_VM;
+			else
+				usage(argv[0]);
+			break;
+		case 'g':
+			lgc_set_threshold(strtol(optarg, NULL, 0));
+			break;
+		case 'i':
+			image_in = optarg;
+			break;
+		case 'w':
+			image_out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	/* the image is written once the files are loaded */
+	if (image_out && optind == argc)
+		usage(argv[0]);
 
-	/* Create Some Parsers */
-	Number = mpc_new("number");
-	Symbol = mpc_new("symbol");
-	Charbuf = mpc_new("charbuf");
-	Comment = mpc_new("comment");
-	Sexpr = mpc_new("sexpr");
-	Qexpr = mpc_new("qexpr");
-	Expr = mpc_new("expr");
-	Lisp = mpc_new("lisp");
-
-	/* Define them with the following Language */
-	mpca_lang(MPCA_LANG_DEFAULT,
-		  "                                                 \
-		number   : /-?[0-9]+/ ;                             \
-		charbuf  : /\"(\\\\.|[^\"])*\"/ ;                   \
-		comment  : /;[^\\r\\n]*/ ;                          \
-		symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%^~|]+/ ;   \
-		sexpr    : '(' <expr>* ')' ;                        \
-		qexpr    : '{' <expr>* '}' ;                        \
-		expr     : <number> | <symbol> | <charbuf> |        \
-		           <comment> | <sexpr> | <qexpr> ;          \
-		lisp    : /^/ <expr>* /$/ ;                         \
-		",
-		  Number, Charbuf, Comment, Symbol, Sexpr, Qexpr, Expr, Lisp);
 	struct lval *v = lval_str(version);
 	struct lenv *e = lenv_new();
 	lenv_add_builtins(e);
 	lval_println(e, v);
 	lval_free(v);
 
-	if (argc >= 2) {
+	if (image_in) {
+		x = lenv_load_image(e, image_in);
+		if (ltype(x) == LVAL_ERR)
+			lval_println(e, x);
+		lval_free(x);
+	}
+
+	if (optind < argc) {
 		/* execute file(s) */
-		for (i = 1; i < argc; i++) {
-			struct lval *args =
-				lval_add(lval_sexpr(), lval_str(argv[i]));
-			struct lval *x = builtin_load(e, args);
+		for (i = optind; i < argc; i++) {
+			x = lenv_load(e, argv[i], 1);
 
-			if (x->type == LVAL_ERR)
+			if (ltype(x) == LVAL_ERR)
+				lval_println(e, x);
+			lval_free(x);
+		}
+		if (image_out) {
+			x = lenv_write_image(e, image_out);
+			if (ltype(x) == LVAL_ERR)
 				lval_println(e, x);
 			lval_free(x);
 		}
 
 	} else {
-		/* repl loop */
+		/* repl loop, the image replaces the library */
 		puts("Press Ctrl+c to Exit\n");
-		struct lval *x = lenv_load(e, "./lsp/lib.lsp");
-		if (x->type == LVAL_ERR)
-			lval_println(e, x);
-		lval_free(x);
+		if (!image_in) {
+			x = lenv_load(e, "./lsp/lib.lsp", 1);
+			if (ltype(x) == LVAL_ERR)
+				lval_println(e, x);
+			lval_free(x);
+		}
 		while (1) {
-			mpc_result_t r;
 			char *input = readline("lisp> ");
+			char *err;
+			if (!input)
+				break;
 			add_history(input);
-			if (mpc_parse("<stdin>", input, Lisp, &r)) {
-				struct lval *x =
-					lval_eval(e, lval_read(r.output));
+			x = lread_all("<stdin>", input, &err);
+			if (x) {
+				x = lval_eval(e, x);
 				lval_println(e, x);
-				mpc_ast_delete(r.output);
 				lval_free(x);
+				if (lgc_due())
+					lgc_collect(e, NULL);
 			} else {
-				mpc_err_print(r.error);
-				mpc_err_delete(r.error);
+				puts(err);
+				free(err);
 			}
+			free(input);
 		}
 	}
 	lenv_free(e);
-	mpc_cleanup(8, Number, Symbol, Charbuf, Comment, Sexpr, Qexpr, Expr,
-		    Lisp);
+	free(builtins);
+	lvm_cleanup();
+	lgc_cleanup();
+	lsym_cleanup();
 	return 0;
 }
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <execinfo.h>
+#include <limits.h>
+#include <stdint.h>
 
 #define warn(fmt, ...) fprintf(stderr, "WARN: " #fmt, __VA_ARGS__);
 #define err(fmt, ...) fprintf(stderr, "ERR:" #fmt, __VA_ARGS__);
@@ -32,6 +34,8 @@
 
 struct lenv;
 struct lval;
+struct lscope;
+struct lcode;
 typedef struct lval *(*lbuiltin)(struct lenv *, struct lval *);
 
 enum {
@@ -43,56 +47,216 @@ enum {
 	LVAL_FUN_BUILTIN,
 	LVAL_SEXPR,
 	LVAL_QEXPR,
+	LVAL_VEC,
 };
 
 enum {
+	LERR_NONE,
 	LERR_DIV_ZERO,
+	LERR_MOD_ZERO,
+	LERR_OVERFLOW,
 	LERR_BAD_OP,
 	LERR_BAD_NUM,
+	LERR_SHIFT,
 };
 
-/* current min size is int + 4 pointers (function lval)
- * which gives us a size of 4 + 8(4) = 36 Bytes on 64b
- * and 4 + 4(4) = 20 Bytest on 32b
+/* current min size is 4 ints + 3 pointers (expression lval)
+ * which gives us a size of 8 + 8 + 8(3) = 40 Bytes on 64b
+ * and 8 + 8 + 4(3) = 28 Bytes on 32b
+ *
+ * lvals are reference counted, an lval with refs > 1 is shared and must not
+ * be modified in place.
  */
 struct lval {
 	int type;
+	int refs;
 
 	union {
 		/* basic */
 		long num;
-		char *sym;
-		char *charbuf;
 		char *err;
 
+		/* Charbuf, charbuf_len bytes which may include NULs followed
+		 * by a NUL. A view has charbuf_cap -1 and points into the
+		 * bytes of charbuf_base, a flat charbuf, with no NUL after
+		 * them. A rope has no bytes of its own, it is the charbufs
+		 * rope_left and rope_right joined and its charbuf_cap is -1
+		 * minus its depth, see lval_rope().
+		 */
+		struct {
+			union {
+				char *charbuf;
+				struct lval *rope_left;
+			};
+			long charbuf_len;
+			long charbuf_cap;
+			union {
+				struct lval *charbuf_base;
+				struct lval *rope_right;
+			};
+		};
+
+		/* Symbol, scope/depth/slot is the lexical address assigned by
+		 * lval_resolve(), scope is NULL for unresolved symbols
+		 */
+		struct {
+			char *sym;
+			struct lscope *scope;
+			short depth;
+			short slot;
+		};
+
 		/* Builtin Function */
 		lbuiltin builtin;
 
-		/* Function */
+		/* Vector of numbers, see lvec.h */
+		struct {
+			int64_t *vec;
+			long vec_len;
+		};
+
+		/* Function, name is the symbol it was first bound to by def
+		 * or = and NULL for a lambda never bound
+		 */
 		struct {
 			struct lenv *env;
 			struct lval *formals;
 			struct lval *body;
+			char *name;
 		};
 
-		/* Expression */
+		/* Expression, code is the compiled form cached by the VM.
+		 *
+		 * A list owning its cells allocated cap of them, the first
+		 * off are free room in front of cell[0]. A view has cap -1
+		 * and shares the cells of base, a list which is not a view.
+		 */
 		struct {
 			int count;
+			int cap;
 			struct lval **cell;
+			struct lcode *code;
+			union {
+				long off;
+				struct lval *base;
+			};
 		};
 	};
 };
 
+/* Numbers between LVAL_FIXNUM_MIN and LVAL_FIXNUM_MAX are not allocated,
+ * they are stored shifted left by one in the pointer itself with the low bit
+ * set (lvals are at least 8 byte aligned). Only larger numbers are boxed, so
+ * every number has exactly one representation.
+ *
+ * Use ltype() and lnum() on anything that may be a number, the other fields
+ * are only valid once the type is known not to be LVAL_NUM.
+ */
+#define LVAL_FIXNUM_MIN (LONG_MIN >> 1)
+#define LVAL_FIXNUM_MAX (LONG_MAX >> 1)
+
+static inline int lval_is_fixnum(const struct lval *v)
+{
+	return (uintptr_t)v & 1;
+}
+
+static inline struct lval *lval_fixnum(long x)
+{
+	return (struct lval *)(((uintptr_t)x << 1) | 1);
+}
+
+static inline int ltype(const struct lval *v)
+{
+	return lval_is_fixnum(v) ? LVAL_NUM : v->type;
+}
+
+static inline long lnum(const struct lval *v)
+{
+	return lval_is_fixnum(v) ? (long)((intptr_t)v >> 1) : v->num;
+}
+
+static inline int lval_is_view(const struct lval *v)
+{
+	return (ltype(v) == LVAL_SEXPR || ltype(v) == LVAL_QEXPR) &&
+	       v->cap < 0;
+}
+
+static inline int lval_is_str_view(const struct lval *v)
+{
+	return ltype(v) == LVAL_CHARBUF && v->charbuf_cap == -1;
+}
+
+static inline int lval_is_rope(const struct lval *v)
+{
+	return ltype(v) == LVAL_CHARBUF && v->charbuf_cap < -1;
+}
+
+/* Names of the formals of a lambda, in slot order ('&' excluded). par is
+ * the scope the lambda was created in.
+ */
+struct lscope {
+	int refs;
+	int count;
+	char **syms; /* interned */
+	struct lscope *par;
+};
+
+/* Function frames bind their formals in a slot array described by scope,
+ * anything else (e.g. put from the function body) goes into the entries.
+ *
+ * Environment entries are kept in insertion order. Once an environment grows
+ * past LENV_SCAN_MAX entries lookups go through a hash index keyed on the
+ * interned symbol pointer, below that a linear pointer scan is faster.
+ */
+#define LENV_MIN_CAP 4
+#define LENV_SCAN_MAX 8
+
 struct lenv {
 	struct lenv *par;
+	struct lscope *scope;
+	struct lval **slots; /* scope->count values, NULL while unbound */
 	struct lval **vals;
-	char **syms;
+	char **syms; /* interned */
 	int count;
+	int cap;
+	int *index; /* entry position + 1, 0 for empty */
+	int index_size;
 };
 
+/* evaluator selected on the command line */
+enum {
+	ENGINE_TREE,
+	ENGINE_VM,
+};
+
+extern int engine;
+
 char *String(char *s, ...);
 char *ltype_name(int t);
 char *lval_to_str(struct lenv *, struct lval *);
 void lval_free(struct lval *);
+void lval_free_shallow(struct lval *);
+void lval_children(struct lval *, void (*fn)(struct lval *));
+void lenv_children(struct lenv *, void (*fn)(struct lval *));
+struct lval *lval_ref(struct lval *);
+struct lval *lval_num(long x);
+struct lval *lval_sym_n(const char *s, size_t n);
+struct lval *lval_sexpr(void);
+struct lval *lval_qexpr(void);
+struct lval *lval_vec(long n);
+struct lval *lval_builtin(lbuiltin func);
+struct lval *lval_add(struct lval *v, struct lval *x);
+struct lval *lval_bind(struct lenv *, struct lval *, struct lval *);
+struct lval *lenv_get(struct lenv *, struct lval *);
+struct lval *builtin_if(struct lenv *, struct lval *);
+char *lbuiltin_name(lbuiltin func);
+/* the bytes of a charbuf, a rope is flattened first */
+char *lval_str_bytes(struct lval *v);
+lbuiltin lbuiltin_by_name(const char *name);
+struct lenv *lenv_new(void);
+struct lenv *lenv_new_frame(struct lscope *scope);
+void lenv_put(struct lenv *e, struct lval *k, struct lval *v);
+void lenv_free(struct lenv *e);
+void lscope_free(struct lscope *s);
 
 #endif
@@ -0,0 +1,846 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "lisp.h"
+#include "lalloc.h"
+#include "lsym.h"
+#include "lgc.h"
+#include "lser.h"
+
+#define LSER_MAGIC "LISPIMG"
+#define LSER_DATA_MAGIC "LISPDAT"
+#define LSER_VERSION 2
+
+/* a tag byte starts every value, SHARED marks a value later referred to by
+ * TAG_REF and its number
+ */
+enum {
+	TAG_NONE,
+	TAG_NUM,
+	TAG_SYM,
+	TAG_CHARBUF,
+	TAG_ERR,
+	TAG_SEXPR,
+	TAG_QEXPR,
+	TAG_VEC,
+	TAG_BUILTIN,
+	TAG_FUN,
+	TAG_REF,
+};
+
+#define TAG_SHARED 0x80
+
+/* numbers the writer handed out, open addressing on the pointer */
+struct lser_map {
+	const void **keys;
+	long *ids;
+	long size;
+	long count;
+};
+
+struct lser_writer {
+	FILE *f;
+	struct lser_map vals;
+	struct lser_map scopes;
+	struct lser_map names;
+};
+
+/* objects in the order they were numbered, each holds a reference */
+struct lser_reader {
+	FILE *f;
+	char *err;
+	unsigned long size; /* of the input if known, otherwise 0 */
+	struct lval **vals;
+	long nvals;
+	struct lscope **scopes;
+	long nscopes;
+	char **names;
+	long nnames;
+};
+
+static unsigned long lser_hash(const void *p)
+{
+	uintptr_t h = (uintptr_t)p >> 3;
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return h;
+}
+
+static long lser_map_get(struct lser_map *m, const void *k)
+{
+	unsigned long i;
+	if (!m->size)
+		return -1;
+	for (i = lser_hash(k) & (m->size - 1); m->keys[i];
+	     i = (i + 1) & (m->size - 1))
+		if (m->keys[i] == k)
+			return m->ids[i];
+	return -1;
+}
+
+/* number k with the next free number */
+static long lser_map_add(struct lser_map *m, const void *k)
+{
+	unsigned long i;
+
+	if ((m->count + 1) * 2 > m->size) {
+		struct lser_map n = { .size = m->size ? m->size * 2 : 256,
+				      .count = m->count };
+		n.keys = xcalloc(sizeof(void *) * n.size);
+		n.ids = xmalloc(sizeof(long) * n.size);
+		for (i = 0; i < (unsigned long)m->size; i++) {
+			unsigned long j;
+			if (!m->keys[i])
+				continue;
+			j = lser_hash(m->keys[i]) & (n.size - 1);
+			while (n.keys[j])
+				j = (j + 1) & (n.size - 1);
+			n.keys[j] = m->keys[i];
+			n.ids[j] = m->ids[i];
+		}
+		free(m->keys);
+		free(m->ids);
+		*m = n;
+	}
+	i = lser_hash(k) & (m->size - 1);
+	while (m->keys[i])
+		i = (i + 1) & (m->size - 1);
+	m->keys[i] = k;
+	m->ids[i] = m->count;
+	return m->count++;
+}
+
+static void lser_map_free(struct lser_map *m)
+{
+	free(m->keys);
+	free(m->ids);
+}
+
+static void lser_writer_free(struct lser_writer *w)
+{
+	lser_map_free(&w->vals);
+	lser_map_free(&w->scopes);
+	lser_map_free(&w->names);
+}
+
+static void lser_reader_free(struct lser_reader *r)
+{
+	long i;
+	for (i = 0; i < r->nvals; i++)
+		if (r->vals[i])
+			lval_free(r->vals[i]);
+	for (i = 0; i < r->nscopes; i++)
+		if (r->scopes[i])
+			lscope_free(r->scopes[i]);
+	free(r->vals);
+	free(r->scopes);
+	free(r->names);
+}
+
+/* writer */
+
+static void put_uint(struct lser_writer *w, unsigned long x)
+{
+	while (x >= 0x80) {
+		putc_unlocked((x & 0x7f) | 0x80, w->f);
+		x >>= 7;
+	}
+	putc_unlocked(x, w->f);
+}
+
+/* zigzag, small negative numbers stay short */
+static void put_int(struct lser_writer *w, long x)
+{
+	put_uint(w, ((unsigned long)x << 1) ^
+			    (unsigned long)(x >> (sizeof(long) * CHAR_BIT - 1)));
+}
+
+static void put_bytes(struct lser_writer *w, const char *s, size_t n)
+{
+	put_uint(w, n);
+	fwrite(s, 1, n, w->f);
+}
+
+/* an interned name, spelled out the first time only */
+static void put_name(struct lser_writer *w, char *name)
+{
+	long id = lser_map_get(&w->names, name);
+	if (id != -1) {
+		put_uint(w, id);
+		return;
+	}
+	put_uint(w, lser_map_add(&w->names, name));
+	put_bytes(w, name, strlen(name));
+}
+
+/* 0 for NULL, otherwise its number + 1, followed by the scope itself the
+ * first time
+ */
+static void put_scope(struct lser_writer *w, struct lscope *s)
+{
+	long id;
+	int i;
+
+	if (!s) {
+		put_uint(w, 0);
+		return;
+	}
+	id = lser_map_get(&w->scopes, s);
+	if (id != -1) {
+		put_uint(w, id + 1);
+		return;
+	}
+	put_uint(w, lser_map_add(&w->scopes, s) + 1);
+	put_scope(w, s->par);
+	put_uint(w, s->count);
+	for (i = 0; i < s->count; i++)
+		put_name(w, s->syms[i]);
+}
+
+static void put_val(struct lser_writer *w, struct lval *v);
+
+static void put_env(struct lser_writer *w, struct lenv *e)
+{
+	int i;
+
+	put_scope(w, e->scope);
+	if (e->scope)
+		for (i = 0; i < e->scope->count; i++)
+			put_val(w, e->slots[i]);
+	put_uint(w, e->count);
+	for (i = 0; i < e->count; i++) {
+		put_name(w, e->syms[i]);
+		put_val(w, e->vals[i]);
+	}
+}
+
+static void put_val(struct lser_writer *w, struct lval *v)
+{
+	int tag = 0;
+	long i;
+
+	if (!v) {
+		putc_unlocked(TAG_NONE, w->f);
+		return;
+	}
+	if (ltype(v) == LVAL_NUM) {
+		putc_unlocked(TAG_NUM, w->f);
+		put_int(w, lnum(v));
+		return;
+	}
+	if (v->refs > 1) {
+		long id = lser_map_get(&w->vals, v);
+		if (id != -1) {
+			putc_unlocked(TAG_REF, w->f);
+			put_uint(w, id);
+			return;
+		}
+		lser_map_add(&w->vals, v);
+		tag = TAG_SHARED;
+	}
+
+	switch (ltype(v)) {
+	case LVAL_SYM:
+		putc_unlocked(tag | TAG_SYM, w->f);
+		put_name(w, v->sym);
+		put_scope(w, v->scope);
+		if (v->scope) {
+			put_uint(w, v->depth);
+			put_uint(w, v->slot);
+		}
+		break;
+	case LVAL_CHARBUF:
+		putc_unlocked(tag | TAG_CHARBUF, w->f);
+		put_bytes(w, lval_str_bytes(v), v->charbuf_len);
+		break;
+	case LVAL_ERR:
+		putc_unlocked(tag | TAG_ERR, w->f);
+		put_bytes(w, v->err, strlen(v->err));
+		break;
+	case LVAL_SEXPR:
+	case LVAL_QEXPR:
+		putc_unlocked(tag | (ltype(v) == LVAL_SEXPR ? TAG_SEXPR : TAG_QEXPR),
+		     w->f);
+		put_uint(w, v->count);
+		for (i = 0; i < v->count; i++)
+			put_val(w, v->cell[i]);
+		break;
+	case LVAL_VEC:
+		putc_unlocked(tag | TAG_VEC, w->f);
+		put_uint(w, v->vec_len);
+		for (i = 0; i < v->vec_len; i++)
+			put_int(w, v->vec[i]);
+		break;
+	case LVAL_FUN_BUILTIN:
+		putc_unlocked(tag | TAG_BUILTIN, w->f);
+		put_name(w, lbuiltin_name(v->builtin));
+		break;
+	case LVAL_FUN:
+		putc_unlocked(tag | TAG_FUN, w->f);
+		put_val(w, v->formals);
+		put_val(w, v->body);
+		put_env(w, v->env);
+		put_uint(w, v->name != NULL);
+		if (v->name)
+			put_name(w, v->name);
+		break;
+	}
+}
+
+int lser_write_image(FILE *f, struct lenv *e)
+{
+	struct lser_writer w = { .f = f };
+	int i;
+
+	fwrite(LSER_MAGIC, 1, sizeof(LSER_MAGIC), f);
+	put_uint(&w, LSER_VERSION);
+	put_uint(&w, sizeof(long));
+	put_uint(&w, e->count);
+	for (i = 0; i < e->count; i++) {
+		put_name(&w, e->syms[i]);
+		put_val(&w, e->vals[i]);
+	}
+
+	lser_writer_free(&w);
+	return fflush(f) || ferror(f) ? -1 : 0;
+}
+
+int lser_write_header(FILE *f)
+{
+	struct lser_writer w = { .f = f };
+	fwrite(LSER_DATA_MAGIC, 1, sizeof(LSER_DATA_MAGIC), f);
+	put_uint(&w, LSER_VERSION);
+	return ferror(f) ? -1 : 0;
+}
+
+/* the record is built in memory first, its length goes in front */
+int lser_write(FILE *f, struct lval *v)
+{
+	struct lser_writer w;
+	char *buf = NULL;
+	size_t len = 0;
+
+	w = (struct lser_writer){ .f = open_memstream(&buf, &len) };
+	if (!w.f)
+		return -1;
+	put_val(&w, v);
+	lser_writer_free(&w);
+	if (fclose(w.f)) {
+		free(buf);
+		return -1;
+	}
+
+	w.f = f;
+	put_uint(&w, len);
+	fwrite(buf, 1, len, f);
+	free(buf);
+	return ferror(f) ? -1 : 0;
+}
+
+/* reader, every get_ function returns 0 or NULL with r->err set on bad
+ * input and frees whatever it built so far
+ */
+
+static void fail(struct lser_reader *r, const char *msg)
+{
+	if (!r->err)
+		r->err = String("%s", (char *)msg);
+}
+
+static int get_uint(struct lser_reader *r, unsigned long *x)
+{
+	int c, shift = 0;
+
+	*x = 0;
+	do {
+		c = getc_unlocked(r->f);
+		if (c == EOF || shift >= (int)sizeof(long) * CHAR_BIT) {
+			fail(r, c == EOF ? "unexpected end of input" :
+					   "bad number");
+			return 0;
+		}
+		*x |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return 1;
+}
+
+static int get_int(struct lser_reader *r, long *x)
+{
+	unsigned long u;
+	if (!get_uint(r, &u))
+		return 0;
+	*x = (long)(u >> 1) ^ -(long)(u & 1);
+	return 1;
+}
+
+/* Number of bytes or elements about to be allocated, each takes at least
+ * a byte of input so there can't be more than its size
+ */
+static int get_count(struct lser_reader *r, unsigned long *n)
+{
+	if (!get_uint(r, n))
+		return 0;
+	if (r->size && *n > r->size) {
+		fail(r, "bad length");
+		return 0;
+	}
+	return 1;
+}
+
+/* append x to the n numbered objects in tab, growing it in powers of two */
+#define push(tab, n, x)                                                        \
+	do {                                                                   \
+		if (!((n) & ((n)-1))) {                                        \
+			(tab) = realloc((tab),                                 \
+					sizeof(*(tab)) * ((n) ? (n)*2 : 1));   \
+			if (!(tab))                                            \
+				die("%s", "failed to allocate memory\n");      \
+		}                                                              \
+		(tab)[(n)++] = (x);                                            \
+	} while (0)
+
+/* n bytes into a new NUL terminated buffer */
+static char *get_bytes(struct lser_reader *r, size_t *len)
+{
+	unsigned long n;
+	char *s;
+
+	if (!get_count(r, &n))
+		return NULL;
+	s = xmalloc(n + 1);
+	if (fread(s, 1, n, r->f) != n) {
+		free(s);
+		fail(r, "unexpected end of input");
+		return NULL;
+	}
+	s[n] = '\0';
+	if (len)
+		*len = n;
+	return s;
+}
+
+static char *get_name(struct lser_reader *r)
+{
+	unsigned long id;
+	size_t n;
+	char *s, *sym;
+
+	if (!get_uint(r, &id))
+		return NULL;
+	if (id < (unsigned long)r->nnames)
+		return r->names[id];
+	if (id != (unsigned long)r->nnames) {
+		fail(r, "bad name");
+		return NULL;
+	}
+	if (!(s = get_bytes(r, &n)))
+		return NULL;
+	sym = lsym_intern_n(s, n);
+	free(s);
+	push(r->names, r->nnames, sym);
+	return sym;
+}
+
+/* a scope, *s is NULL for none, the reader keeps the reference */
+static int get_scope(struct lser_reader *r, struct lscope **s)
+{
+	unsigned long id, count, i;
+	struct lscope *par;
+	long slot;
+
+	if (!get_uint(r, &id))
+		return 0;
+	*s = NULL;
+	if (!id--)
+		return 1;
+	if (id < (unsigned long)r->nscopes) {
+		if (!(*s = r->scopes[id]))
+			fail(r, "scope used inside its own definition");
+		return *s != NULL;
+	}
+	if (id != (unsigned long)r->nscopes) {
+		fail(r, "bad scope");
+		return 0;
+	}
+
+	/* numbered before its parent like in the writer */
+	slot = r->nscopes;
+	push(r->scopes, r->nscopes, NULL);
+	if (!get_scope(r, &par) || !get_count(r, &count))
+		return 0;
+	if (count > INT_MAX) {
+		fail(r, "bad scope");
+		return 0;
+	}
+	*s = lalloc(sizeof(struct lscope));
+	(*s)->refs = 1;
+	/* count is the allocated size, lscope_free frees by it when a name
+	 * below fails to decode */
+	(*s)->count = count;
+	(*s)->syms = lalloc(sizeof(char *) * count);
+	(*s)->par = par;
+	if (par)
+		par->refs++;
+	r->scopes[slot] = *s;
+	for (i = 0; i < count; i++)
+		(*s)->syms[i] = NULL;
+	for (i = 0; i < count; i++) {
+		char *sym = get_name(r);
+		if (!sym)
+			return 0;
+		(*s)->syms[i] = sym;
+	}
+	return 1;
+}
+
+static struct lval *get_val(struct lser_reader *r);
+
+/* NULL stands for both bad input and TAG_NONE, check r->err */
+static struct lenv *get_env(struct lser_reader *r)
+{
+	struct lscope *s;
+	struct lenv *e;
+	unsigned long count, i;
+
+	if (!get_scope(r, &s))
+		return NULL;
+	e = s ? lenv_new_frame(s) : lenv_new();
+	if (s) {
+		for (i = 0; i < (unsigned long)s->count; i++) {
+			e->slots[i] = get_val(r);
+			if (r->err)
+				goto err;
+		}
+	}
+	if (!get_uint(r, &count))
+		goto err;
+	for (i = 0; i < count; i++) {
+		char *sym = get_name(r);
+		struct lval *k, *v;
+		if (!sym || !(v = get_val(r))) {
+			fail(r, "bad binding");
+			goto err;
+		}
+		k = lval_sym_n(sym, strlen(sym));
+		lenv_put(e, k, v);
+		lval_free(k);
+		lval_free(v);
+	}
+	return e;
+err:
+	lenv_free(e);
+	return NULL;
+}
+
+static struct lval *get_list(struct lser_reader *r, struct lval *v)
+{
+	unsigned long count, i;
+
+	if (!get_uint(r, &count))
+		goto err;
+	for (i = 0; i < count; i++) {
+		struct lval *x = get_val(r);
+		if (!x) {
+			fail(r, "bad list");
+			goto err;
+		}
+		lval_add(v, x);
+	}
+	return v;
+err:
+	lval_free(v);
+	return NULL;
+}
+
+/* formals of a function are a Q-Expression of symbols, lval_bind() relies
+ * on that
+ */
+static int is_formals(const struct lval *v)
+{
+	int i;
+
+	if (!v || ltype(v) != LVAL_QEXPR)
+		return 0;
+	for (i = 0; i < v->count; i++)
+		if (ltype(v->cell[i]) != LVAL_SYM)
+			return 0;
+	return 1;
+}
+
+static struct lval *get_val(struct lser_reader *r)
+{
+	struct lval *v = NULL;
+	unsigned long u, i;
+	long x, slot = -1;
+	size_t len;
+	char *s;
+	int tag = getc_unlocked(r->f);
+
+	if (tag == EOF) {
+		fail(r, "unexpected end of input");
+		return NULL;
+	}
+	if (tag & TAG_SHARED) {
+		slot = r->nvals;
+		push(r->vals, r->nvals, NULL);
+		tag &= ~TAG_SHARED;
+	}
+
+	switch (tag) {
+	case TAG_NONE:
+		return NULL;
+	case TAG_NUM:
+		if (get_int(r, &x))
+			v = lval_num(x);
+		break;
+	case TAG_REF:
+		if (!get_uint(r, &u))
+			return NULL;
+		if (u >= (unsigned long)r->nvals || !r->vals[u]) {
+			fail(r, "bad reference");
+			return NULL;
+		}
+		return lval_ref(r->vals[u]);
+	case TAG_SYM: {
+		struct lscope *scope;
+		unsigned long depth = 0, pos = 0;
+		if (!(s = get_name(r)) || !get_scope(r, &scope))
+			return NULL;
+		if (scope && (!get_uint(r, &depth) || !get_uint(r, &pos)))
+			return NULL;
+		if (scope) {
+			/* the address is used without further checks */
+			struct lscope *it = scope;
+			for (i = depth; it && i; i--)
+				it = it->par;
+			if (!it || pos >= (unsigned long)it->count) {
+				fail(r, "bad symbol address");
+				return NULL;
+			}
+		}
+		v = lgc_alloc();
+		v->type = LVAL_SYM;
+		v->refs = 1;
+		v->sym = s;
+		v->scope = scope;
+		if (scope)
+			scope->refs++;
+		v->depth = depth;
+		v->slot = pos;
+		break;
+	}
+	case TAG_CHARBUF:
+	case TAG_ERR:
+		if (!(s = get_bytes(r, &len)))
+			return NULL;
+		v = lgc_alloc();
+		v->type = tag == TAG_ERR ? LVAL_ERR : LVAL_CHARBUF;
+		v->refs = 1;
+		if (tag == TAG_ERR) {
+			v->err = s;
+		} else {
+			v->charbuf = s;
+			v->charbuf_len = len;
+			v->charbuf_cap = len + 1;
+			v->charbuf_base = NULL;
+		}
+		break;
+	case TAG_SEXPR:
+		v = get_list(r, lval_sexpr());
+		break;
+	case TAG_QEXPR:
+		v = get_list(r, lval_qexpr());
+		break;
+	case TAG_VEC:
+		if (!get_count(r, &u))
+			return NULL;
+		v = lval_vec(u);
+		for (i = 0; i < u; i++) {
+			if (!get_int(r, &x)) {
+				lval_free(v);
+				return NULL;
+			}
+			v->vec[i] = x;
+		}
+		break;
+	case TAG_BUILTIN: {
+		lbuiltin func;
+		if (!(s = get_name(r)))
+			return NULL;
+		if (!(func = lbuiltin_by_name(s))) {
+			r->err = String("unknown builtin '%s'", s);
+			return NULL;
+		}
+		v = lval_builtin(func);
+		break;
+	}
+	case TAG_FUN: {
+		struct lval *formals = get_val(r), *body = NULL;
+		struct lenv *env = NULL;
+		char *name = NULL;
+		if (!r->err && !is_formals(formals))
+			fail(r, "bad function formals");
+		if (!r->err)
+			body = get_val(r);
+		if (!r->err && (!body || ltype(body) != LVAL_QEXPR))
+			fail(r, "bad function body");
+		if (!r->err)
+			env = get_env(r);
+		if (!r->err && get_uint(r, &u) && u)
+			name = get_name(r);
+		if (r->err) {
+			if (formals)
+				lval_free(formals);
+			if (body)
+				lval_free(body);
+			if (env)
+				lenv_free(env);
+			return NULL;
+		}
+		v = lgc_alloc();
+		v->type = LVAL_FUN;
+		v->refs = 1;
+		v->formals = formals;
+		v->body = body;
+		v->env = env;
+		v->name = name;
+		break;
+	}
+	default:
+		fail(r, "bad tag");
+		return NULL;
+	}
+
+	if (v && slot != -1)
+		r->vals[slot] = lval_ref(v);
+	return v;
+}
+
+char *lser_read_image(FILE *f, struct lenv *e)
+{
+	struct lser_reader r = { .f = f };
+	char magic[sizeof(LSER_MAGIC)];
+	unsigned long version, long_size, count, i;
+	struct stat st;
+	char **syms = NULL;
+	struct lval **vals = NULL;
+	long nsyms = 0, nvals = 0, j;
+
+	if (!fstat(fileno(f), &st) && S_ISREG(st.st_mode))
+		r.size = st.st_size;
+
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+	    memcmp(magic, LSER_MAGIC, sizeof(magic)))
+		return String("%s", "not an image");
+	if (!get_uint(&r, &version) || !get_uint(&r, &long_size))
+		return r.err;
+	if (version != LSER_VERSION || long_size != sizeof(long))
+		return String("image version %lu/%lu, expected %d/%zu",
+			      version, long_size, LSER_VERSION, sizeof(long));
+
+	/* all bindings are decoded before any is put, a bad image leaves e as
+	 * it was
+	 */
+	if (get_uint(&r, &count)) {
+		for (i = 0; i < count; i++) {
+			char *sym = get_name(&r);
+			struct lval *v;
+			if (!sym || !(v = get_val(&r))) {
+				fail(&r, "bad binding");
+				break;
+			}
+			push(syms, nsyms, sym);
+			push(vals, nvals, v);
+		}
+	}
+
+	for (j = 0; j < nvals; j++) {
+		if (!r.err) {
+			struct lval *k = lval_sym_n(syms[j], strlen(syms[j]));
+			lenv_put(e, k, vals[j]);
+			lval_free(k);
+		}
+		lval_free(vals[j]);
+	}
+	free(syms);
+	free(vals);
+	lser_reader_free(&r);
+	return r.err;
+}
+
+char *lser_read_header(FILE *f)
+{
+	struct lser_reader r = { .f = f };
+	char magic[sizeof(LSER_DATA_MAGIC)];
+	unsigned long version;
+
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+	    memcmp(magic, LSER_DATA_MAGIC, sizeof(magic)))
+		return String("%s", "not a data file");
+	if (!get_uint(&r, &version))
+		return r.err;
+	if (version != LSER_VERSION)
+		return String("data version %lu, expected %d", version,
+			      LSER_VERSION);
+	return NULL;
+}
+
+/* Only the record is held in memory, it is read whole before decoding so
+ * the reader can't run past its end
+ */
+char *lser_read(FILE *f, struct lval **v)
+{
+	struct lser_reader r = { .f = f };
+	unsigned long len, n, cap, got;
+	char *buf;
+	int c;
+
+	*v = NULL;
+	if ((c = getc_unlocked(f)) == EOF)
+		return ferror(f) ? String("%s", "read failed") : NULL;
+	ungetc(c, f);
+	if (!get_uint(&r, &len))
+		return r.err;
+	if (!len)
+		return String("%s", "empty record");
+
+	/* grown as the bytes arrive, a corrupt length runs into the end of
+	 * the file before it can ask for too much memory
+	 */
+	for (n = 0, cap = 0, buf = NULL; n < len; n += got) {
+		if (n == cap) {
+			cap = cap ? cap * 2 : 4096;
+			buf = realloc(buf, cap < len ? cap : len);
+			if (!buf)
+				die("%s", "failed to allocate memory\n");
+		}
+		got = fread(buf + n, 1, (cap < len ? cap : len) - n, f);
+		if (!got) {
+			free(buf);
+			return String("%s", "unexpected end of input");
+		}
+	}
+	r.f = fmemopen(buf, len, "rb");
+	r.size = len;
+	if (!r.f) {
+		free(buf);
+		return String("%s", "out of memory");
+	}
+	*v = get_val(&r);
+	if (!r.err && !*v)
+		fail(&r, "empty record");
+	if (!r.err && getc_unlocked(r.f) != EOF)
+		fail(&r, "bad record length");
+	if (r.err && *v) {
+		lval_free(*v);
+		*v = NULL;
+	}
+	fclose(r.f);
+	free(buf);
+	lser_reader_free(&r);
+	return r.err;
+}
@@ -0,0 +1,29 @@
+#ifndef _LSER_H
+#define _LSER_H
+#include <stdio.h>
+
+/* Binary encoding of lvals
+ *
+ * Values are written depth first, numbers and lengths as varints. Lvals
+ * shared by more than one reference, scopes and symbol names are written
+ * once and referred to by number after that, so sharing survives a round
+ * trip. Compiled code is not written, it is rebuilt on first use. Builtins
+ * are stored by name and must exist in the interpreter reading them back.
+ *
+ * An image holds every binding of the global environment. A data file is a
+ * header followed by records, each a length and one value encoded on its
+ * own, so a file is read a record at a time and can be appended to.
+ *
+ * The read functions return NULL on success, otherwise a message the
+ * caller frees.
+ */
+int lser_write_image(FILE *f, struct lenv *e);
+char *lser_read_image(FILE *f, struct lenv *e);
+
+int lser_write_header(FILE *f);
+int lser_write(FILE *f, struct lval *v);
+char *lser_read_header(FILE *f);
+/* *v is NULL at the end of the file */
+char *lser_read(FILE *f, struct lval **v);
+
+#endif
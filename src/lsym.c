@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <string.h>
+#include "lisp.h"
+#include "lsym.h"
+
+/* open addressing hash set of names, size is always a power of two */
+static char **atoms;
+static size_t atoms_count;
+static size_t atoms_size;
+
+static unsigned long lsym_hash_str(const char *s, size_t n)
+{
+	/* FNV-1a */
+	unsigned long h = 2166136261UL;
+	while (n--) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619UL;
+	}
+	return h;
+}
+
+/* hash of an interned name, interned pointers are unique so the address is
+ * enough, the low bits are always zero because of malloc alignment
+ */
+unsigned long lsym_hash_ptr(const char *sym)
+{
+	uintptr_t h = (uintptr_t)sym >> 4;
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return h;
+}
+
+static void lsym_grow(void)
+{
+	size_t i, j;
+	size_t size = atoms_size ? atoms_size * 2 : 256;
+	char **n = xcalloc(sizeof(char *) * size);
+
+	for (i = 0; i < atoms_size; i++) {
+		if (!atoms[i])
+			continue;
+		j = lsym_hash_str(atoms[i], strlen(atoms[i])) & (size - 1);
+		while (n[j])
+			j = (j + 1) & (size - 1);
+		n[j] = atoms[i];
+	}
+	free(atoms);
+	atoms = n;
+	atoms_size = size;
+}
+
+char *lsym_intern(const char *s)
+{
+	return lsym_intern_n(s, strlen(s));
+}
+
+char *lsym_intern_n(const char *s, size_t n)
+{
+	size_t i;
+
+	/* keep the load factor below 1/2 */
+	if ((atoms_count + 1) * 2 > atoms_size)
+		lsym_grow();
+
+	i = lsym_hash_str(s, n) & (atoms_size - 1);
+	while (atoms[i]) {
+		if (strncmp(atoms[i], s, n) == 0 && !atoms[i][n])
+			return atoms[i];
+		i = (i + 1) & (atoms_size - 1);
+	}
+	atoms[i] = xmalloc(n + 1);
+	memcpy(atoms[i], s, n);
+	atoms[i][n] = '\0';
+	atoms_count++;
+	return atoms[i];
+}
+
+void lsym_cleanup(void)
+{
+	size_t i;
+	for (i = 0; i < atoms_size; i++)
+		free(atoms[i]);
+	free(atoms);
+	atoms = NULL;
+	atoms_count = 0;
+	atoms_size = 0;
+}
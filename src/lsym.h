@@ -0,0 +1,16 @@
+#ifndef _LSYM_H
+#define _LSYM_H
+#include <stddef.h>
+
+/* Symbol interning
+ *
+ * Every symbol name is stored once in a global atom table, two interned
+ * names are equal if and only if their pointers are equal. Interned
+ * strings live until lsym_cleanup() and must not be freed by the caller.
+ */
+char *lsym_intern(const char *s);
+char *lsym_intern_n(const char *s, size_t n); /* s needs no terminator */
+unsigned long lsym_hash_ptr(const char *sym);
+void lsym_cleanup(void);
+
+#endif
@@ -0,0 +1,379 @@
+#include <string.h>
+#include "lvec.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+/* wrapping arithmetic without signed overflow */
+#define WRAP(op, a, b) ((int64_t)((uint64_t)(a) op (uint64_t)(b)))
+
+struct lvec_kernels {
+	void (*add)(int64_t *, const int64_t *, const int64_t *, long);
+	void (*sub)(int64_t *, const int64_t *, const int64_t *, long);
+	void (*mul)(int64_t *, const int64_t *, const int64_t *, long);
+	void (*eq)(int64_t *, const int64_t *, const int64_t *, long);
+	void (*gt)(int64_t *, const int64_t *, const int64_t *, long);
+	int64_t (*sum)(const int64_t *, long);
+	int64_t (*dot)(const int64_t *, const int64_t *, long);
+	int64_t (*min)(const int64_t *, long);
+	int64_t (*max)(const int64_t *, long);
+};
+
+static const char *isa_names[] = { "scalar", "sse2", "avx2" };
+
+/* scalar, also finishes the elements left over by the SIMD loops */
+#define SCALAR_BINARY(name, expr)                                              \
+	static void name##_scalar(int64_t *out, const int64_t *x,              \
+				  const int64_t *y, long n)                    \
+	{                                                                      \
+		long i;                                                        \
+		for (i = 0; i < n; i++)                                        \
+			out[i] = (expr);                                       \
+	}
+
+SCALAR_BINARY(add, WRAP(+, x[i], y[i]))
+SCALAR_BINARY(sub, WRAP(-, x[i], y[i]))
+SCALAR_BINARY(mul, WRAP(*, x[i], y[i]))
+SCALAR_BINARY(eq, x[i] == y[i])
+SCALAR_BINARY(gt, x[i] > y[i])
+
+static int64_t sum_scalar(const int64_t *x, long n)
+{
+	uint64_t s = 0;
+	long i;
+	for (i = 0; i < n; i++)
+		s += (uint64_t)x[i];
+	return (int64_t)s;
+}
+
+static int64_t dot_scalar(const int64_t *x, const int64_t *y, long n)
+{
+	uint64_t s = 0;
+	long i;
+	for (i = 0; i < n; i++)
+		s += (uint64_t)x[i] * (uint64_t)y[i];
+	return (int64_t)s;
+}
+
+static int64_t min_scalar(const int64_t *x, long n)
+{
+	int64_t m = x[0];
+	long i;
+	for (i = 1; i < n; i++)
+		if (x[i] < m)
+			m = x[i];
+	return m;
+}
+
+static int64_t max_scalar(const int64_t *x, long n)
+{
+	int64_t m = x[0];
+	long i;
+	for (i = 1; i < n; i++)
+		if (x[i] > m)
+			m = x[i];
+	return m;
+}
+
+static const struct lvec_kernels kernels_scalar = {
+	add_scalar, sub_scalar, mul_scalar, eq_scalar, gt_scalar,
+	sum_scalar, dot_scalar, min_scalar, max_scalar,
+};
+
+#ifdef __x86_64__
+
+/* SSE2 has no 64 bit multiply or compare, build them from 32 bit ones.
+ * Signed 64 bit greater than needs SSE4.2, gt, min and max stay scalar.
+ */
+static inline __m128i mul64_sse2(__m128i a, __m128i b)
+{
+	__m128i lo = _mm_mul_epu32(a, b);
+	__m128i ah = _mm_mul_epu32(_mm_srli_epi64(a, 32), b);
+	__m128i bh = _mm_mul_epu32(a, _mm_srli_epi64(b, 32));
+	return _mm_add_epi64(lo, _mm_slli_epi64(_mm_add_epi64(ah, bh), 32));
+}
+
+static inline __m128i eq64_sse2(__m128i a, __m128i b)
+{
+	__m128i t = _mm_cmpeq_epi32(a, b);
+	t = _mm_and_si128(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_srli_epi64(t, 63);
+}
+
+#define SSE2_BINARY(name, op)                                                  \
+	static void name##_sse2(int64_t *out, const int64_t *x,                \
+				const int64_t *y, long n)                      \
+	{                                                                      \
+		long i = 0;                                                    \
+		for (; i + 2 <= n; i += 2) {                                   \
+			__m128i a = _mm_loadu_si128((const __m128i *)(x + i)); \
+			__m128i b = _mm_loadu_si128((const __m128i *)(y + i)); \
+			_mm_storeu_si128((__m128i *)(out + i), op(a, b));      \
+		}                                                              \
+		name##_scalar(out + i, x + i, y + i, n - i);                   \
+	}
+
+SSE2_BINARY(add, _mm_add_epi64)
+SSE2_BINARY(sub, _mm_sub_epi64)
+SSE2_BINARY(mul, mul64_sse2)
+SSE2_BINARY(eq, eq64_sse2)
+
+static int64_t hsum_sse2(__m128i v)
+{
+	int64_t s[2];
+	_mm_storeu_si128((__m128i *)s, v);
+	return WRAP(+, s[0], s[1]);
+}
+
+static int64_t sum_sse2(const int64_t *x, long n)
+{
+	__m128i acc = _mm_setzero_si128();
+	long i = 0;
+	for (; i + 2 <= n; i += 2)
+		acc = _mm_add_epi64(acc,
+				    _mm_loadu_si128((const __m128i *)(x + i)));
+	return WRAP(+, hsum_sse2(acc), sum_scalar(x + i, n - i));
+}
+
+static int64_t dot_sse2(const int64_t *x, const int64_t *y, long n)
+{
+	__m128i acc = _mm_setzero_si128();
+	long i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(x + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(y + i));
+		acc = _mm_add_epi64(acc, mul64_sse2(a, b));
+	}
+	return WRAP(+, hsum_sse2(acc), dot_scalar(x + i, y + i, n - i));
+}
+
+static const struct lvec_kernels kernels_sse2 = {
+	add_sse2, sub_sse2, mul_sse2, eq_sse2, gt_scalar,
+	sum_sse2, dot_sse2, min_scalar, max_scalar,
+};
+
+static inline AVX2 __m256i mul64_avx2(__m256i a, __m256i b)
+{
+	__m256i lo = _mm256_mul_epu32(a, b);
+	__m256i ah = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+	__m256i bh = _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32));
+	return _mm256_add_epi64(lo,
+				_mm256_slli_epi64(_mm256_add_epi64(ah, bh), 32));
+}
+
+static inline AVX2 __m256i eq64_avx2(__m256i a, __m256i b)
+{
+	return _mm256_srli_epi64(_mm256_cmpeq_epi64(a, b), 63);
+}
+
+static inline AVX2 __m256i gt64_avx2(__m256i a, __m256i b)
+{
+	return _mm256_srli_epi64(_mm256_cmpgt_epi64(a, b), 63);
+}
+
+#define AVX2_BINARY(name, op)                                                  \
+	static AVX2 void name##_avx2(int64_t *out, const int64_t *x,           \
+				     const int64_t *y, long n)                 \
+	{                                                                      \
+		long i = 0;                                                    \
+		for (; i + 4 <= n; i += 4) {                                   \
+			__m256i a =                                            \
+				_mm256_loadu_si256((const __m256i *)(x + i));  \
+			__m256i b =                                            \
+				_mm256_loadu_si256((const __m256i *)(y + i));  \
+			_mm256_storeu_si256((__m256i *)(out + i), op(a, b));   \
+		}                                                              \
+		name##_scalar(out + i, x + i, y + i, n - i);                   \
+	}
+
+AVX2_BINARY(add, _mm256_add_epi64)
+AVX2_BINARY(sub, _mm256_sub_epi64)
+AVX2_BINARY(mul, mul64_avx2)
+AVX2_BINARY(eq, eq64_avx2)
+AVX2_BINARY(gt, gt64_avx2)
+
+static AVX2 int64_t hsum_avx2(__m256i v)
+{
+	int64_t s[4];
+	_mm256_storeu_si256((__m256i *)s, v);
+	return WRAP(+, WRAP(+, s[0], s[1]), WRAP(+, s[2], s[3]));
+}
+
+static AVX2 int64_t sum_avx2(const int64_t *x, long n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	long i = 0;
+	for (; i + 4 <= n; i += 4)
+		acc = _mm256_add_epi64(
+			acc, _mm256_loadu_si256((const __m256i *)(x + i)));
+	return WRAP(+, hsum_avx2(acc), sum_scalar(x + i, n - i));
+}
+
+static AVX2 int64_t dot_avx2(const int64_t *x, const int64_t *y, long n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	long i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(x + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(y + i));
+		acc = _mm256_add_epi64(acc, mul64_avx2(a, b));
+	}
+	return WRAP(+, hsum_avx2(acc), dot_scalar(x + i, y + i, n - i));
+}
+
+/* keep the smaller (max: larger) value of every lane, then of the lanes */
+static AVX2 int64_t minmax_avx2(const int64_t *x, long n, int max)
+{
+	__m256i acc = _mm256_set1_epi64x(x[0]);
+	int64_t lanes[4], m;
+	long i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+		__m256i gt = max ? _mm256_cmpgt_epi64(v, acc) :
+				   _mm256_cmpgt_epi64(acc, v);
+		acc = _mm256_blendv_epi8(acc, v, gt);
+	}
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	m = max ? max_scalar(lanes, 4) : min_scalar(lanes, 4);
+	for (; i < n; i++)
+		if (max ? x[i] > m : x[i] < m)
+			m = x[i];
+	return m;
+}
+
+static AVX2 int64_t min_avx2(const int64_t *x, long n)
+{
+	return minmax_avx2(x, n, 0);
+}
+
+static AVX2 int64_t max_avx2(const int64_t *x, long n)
+{
+	return minmax_avx2(x, n, 1);
+}
+
+static const struct lvec_kernels kernels_avx2 = {
+	add_avx2, sub_avx2, mul_avx2, eq_avx2, gt_avx2,
+	sum_avx2, dot_avx2, min_avx2, max_avx2,
+};
+
+#endif
+
+static int isa = -1; /* picked on first use */
+static const struct lvec_kernels *kernels;
+
+int lvec_isa_supported(int i)
+{
+	switch (i) {
+	case LVEC_SCALAR:
+		return 1;
+#ifdef __x86_64__
+	case LVEC_SSE2:
+		return 1;
+	case LVEC_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return 0;
+	}
+}
+
+/* i must be supported */
+void lvec_set_isa(int i)
+{
+	isa = i;
+	switch (i) {
+#ifdef __x86_64__
+	case LVEC_AVX2:
+		kernels = &kernels_avx2;
+		break;
+	case LVEC_SSE2:
+		kernels = &kernels_sse2;
+		break;
+#endif
+	default:
+		kernels = &kernels_scalar;
+		break;
+	}
+}
+
+int lvec_isa(void)
+{
+	int i;
+	if (isa < 0) {
+		for (i = LVEC_AVX2; !lvec_isa_supported(i); i--)
+			;
+		lvec_set_isa(i);
+	}
+	return isa;
+}
+
+const char *lvec_isa_name(int i)
+{
+	return isa_names[i];
+}
+
+int lvec_isa_by_name(const char *name)
+{
+	int i;
+	for (i = LVEC_SCALAR; i <= LVEC_AVX2; i++)
+		if (strcmp(name, isa_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+void lvec_add(int64_t *out, const int64_t *x, const int64_t *y, long n)
+{
+	lvec_isa();
+	kernels->add(out, x, y, n);
+}
+
+void lvec_sub(int64_t *out, const int64_t *x, const int64_t *y, long n)
+{
+	lvec_isa();
+	kernels->sub(out, x, y, n);
+}
+
+void lvec_mul(int64_t *out, const int64_t *x, const int64_t *y, long n)
+{
+	lvec_isa();
+	kernels->mul(out, x, y, n);
+}
+
+void lvec_eq(int64_t *out, const int64_t *x, const int64_t *y, long n)
+{
+	lvec_isa();
+	kernels->eq(out, x, y, n);
+}
+
+void lvec_gt(int64_t *out, const int64_t *x, const int64_t *y, long n)
+{
+	lvec_isa();
+	kernels->gt(out, x, y, n);
+}
+
+int64_t lvec_sum(const int64_t *x, long n)
+{
+	lvec_isa();
+	return kernels->sum(x, n);
+}
+
+int64_t lvec_dot(const int64_t *x, const int64_t *y, long n)
+{
+	lvec_isa();
+	return kernels->dot(x, y, n);
+}
+
+int64_t lvec_min(const int64_t *x, long n)
+{
+	lvec_isa();
+	return kernels->min(x, n);
+}
+
+int64_t lvec_max(const int64_t *x, long n)
+{
+	lvec_isa();
+	return kernels->max(x, n);
+}
@@ -0,0 +1,36 @@
+#ifndef _LVEC_H
+#define _LVEC_H
+#include <stdint.h>
+
+/* Kernels over packed int64 arrays, used by the vector builtins
+ *
+ * Every kernel has a scalar version and SSE2 and AVX2 versions on x86-64,
+ * the best one the CPU supports is picked at runtime and lvec_set_isa() can
+ * force a lower one. Arithmetic wraps around like machine integers, the
+ * comparisons store 1 or 0 per element.
+ */
+enum {
+	LVEC_SCALAR,
+	LVEC_SSE2,
+	LVEC_AVX2,
+};
+
+int lvec_isa(void);
+int lvec_isa_supported(int isa);
+void lvec_set_isa(int isa);
+const char *lvec_isa_name(int isa);
+int lvec_isa_by_name(const char *name); /* -1 if unknown */
+
+void lvec_add(int64_t *out, const int64_t *x, const int64_t *y, long n);
+void lvec_sub(int64_t *out, const int64_t *x, const int64_t *y, long n);
+void lvec_mul(int64_t *out, const int64_t *x, const int64_t *y, long n);
+void lvec_eq(int64_t *out, const int64_t *x, const int64_t *y, long n);
+void lvec_gt(int64_t *out, const int64_t *x, const int64_t *y, long n);
+
+int64_t lvec_sum(const int64_t *x, long n);
+int64_t lvec_dot(const int64_t *x, const int64_t *y, long n);
+/* n must not be 0 */
+int64_t lvec_min(const int64_t *x, long n);
+int64_t lvec_max(const int64_t *x, long n);
+
+#endif
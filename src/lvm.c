@@ -0,0 +1,392 @@
+#include <string.h>
+#include "lisp.h"
+#include "lerr.h"
+#include "lalloc.h"
+#include "lsym.h"
+#include "lvm.h"
+
+/* Instructions are an opcode followed by its operands, all ints
+ *
+ * OP_CONST k           push consts[k]
+ * OP_LOAD k            push the value of the symbol consts[k]
+ * OP_EMPTY             push ()
+ * OP_CALL n            call the function below the top n values with them
+ * OP_TAILCALL n        same as OP_CALL, but reuse the current frame when
+ *                      the callee is the running function
+ * OP_IF else generic   with the builtin if and a number below the top, drop
+ *                      both and continue with the then branch or jump to
+ *                      else, otherwise jump to generic which calls if
+ * OP_JUMP pc           continue at pc
+ * OP_RET               return the top of the stack from the frame
+ */
+enum {
+	OP_CONST,
+	OP_LOAD,
+	OP_EMPTY,
+	OP_CALL,
+	OP_TAILCALL,
+	OP_IF,
+	OP_JUMP,
+	OP_RET,
+};
+
+/* Compiled form of a list evaluated as an S-expression
+ *
+ * The code holds a reference to every lval it was compiled from, shared
+ * lvals are never modified in place so the code stays valid for as long as
+ * the list it is cached on is not modified.
+ */
+struct lcode {
+	int *ops;
+	int count;
+	int cap;
+	struct lval **consts;
+	int nconsts;
+	int consts_cap;
+};
+
+/* owner keeps code alive, it is the function being run or the list
+ * passed to lvm_eval()
+ */
+struct lframe {
+	struct lcode *code;
+	int pc;
+	struct lenv *env;
+	struct lval *owner;
+};
+
+/* shared by nested lvm_eval() calls from builtins, always index them since
+ * they move when they grow
+ */
+static struct lval **stack;
+static int sp;
+static int stack_cap;
+static struct lframe *frames;
+static int fp;
+static int frames_cap;
+
+static char *sym_if;
+
+static int emit(struct lcode *c, int op)
+{
+	if (c->count == c->cap) {
+		int cap = c->cap ? c->cap * 2 : 8;
+		c->ops = lrealloc(c->ops, sizeof(int) * c->cap,
+				  sizeof(int) * cap);
+		c->cap = cap;
+	}
+	c->ops[c->count] = op;
+	return c->count++;
+}
+
+static int emit_const(struct lcode *c, struct lval *v)
+{
+	if (c->nconsts == c->consts_cap) {
+		int cap = c->consts_cap ? c->consts_cap * 2 : 4;
+		c->consts = lrealloc(c->consts,
+				     sizeof(struct lval *) * c->consts_cap,
+				     sizeof(struct lval *) * cap);
+		c->consts_cap = cap;
+	}
+	c->consts[c->nconsts] = lval_ref(v);
+	return c->nconsts++;
+}
+
+static void compile_list(struct lcode *c, struct lval *v, int tail);
+
+/* compile the evaluation of v, tail positions end with OP_RET */
+static void compile_expr(struct lcode *c, struct lval *v, int tail)
+{
+	switch (ltype(v)) {
+	case LVAL_SYM:
+		emit(c, OP_LOAD);
+		emit(c, emit_const(c, v));
+		break;
+	case LVAL_SEXPR:
+		/* hold a reference so it is not modified under us */
+		emit_const(c, v);
+		compile_list(c, v, tail);
+		return;
+	default:
+		emit(c, OP_CONST);
+		emit(c, emit_const(c, v));
+		break;
+	}
+	if (tail)
+		emit(c, OP_RET);
+}
+
+/* (if cond {then} {else}) with literal branches */
+static int is_if(struct lval *v)
+{
+	return v->count == 4 && ltype(v->cell[0]) == LVAL_SYM &&
+	       v->cell[0]->sym == sym_if && ltype(v->cell[2]) == LVAL_QEXPR &&
+	       ltype(v->cell[3]) == LVAL_QEXPR;
+}
+
+static void compile_if(struct lcode *c, struct lval *v, int tail)
+{
+	int op, end_then = 0, end_else = 0;
+
+	compile_expr(c, v->cell[0], 0);
+	compile_expr(c, v->cell[1], 0);
+	op = emit(c, OP_IF);
+	emit(c, 0);
+	emit(c, 0);
+
+	emit_const(c, v->cell[2]);
+	compile_list(c, v->cell[2], tail);
+	if (!tail) {
+		emit(c, OP_JUMP);
+		end_then = emit(c, 0);
+	}
+
+	c->ops[op + 1] = c->count;
+	emit_const(c, v->cell[3]);
+	compile_list(c, v->cell[3], tail);
+	if (!tail) {
+		emit(c, OP_JUMP);
+		end_else = emit(c, 0);
+	}
+
+	/* not the builtin if or not a number, let if deal with it */
+	c->ops[op + 2] = c->count;
+	compile_expr(c, v->cell[2], 0);
+	compile_expr(c, v->cell[3], 0);
+	emit(c, tail ? OP_TAILCALL : OP_CALL);
+	emit(c, 3);
+	if (tail) {
+		emit(c, OP_RET);
+	} else {
+		c->ops[end_then] = c->count;
+		c->ops[end_else] = c->count;
+	}
+}
+
+/* Same rules as lval_eval(): every child is evaluated, () is
+ * returned as is, a single child is its own value, otherwise the first
+ * child is called with the rest
+ */
+static void compile_list(struct lcode *c, struct lval *v, int tail)
+{
+	int i;
+
+	if (v->count == 0) {
+		emit(c, OP_EMPTY);
+		if (tail)
+			emit(c, OP_RET);
+		return;
+	}
+	if (v->count == 1) {
+		compile_expr(c, v->cell[0], tail);
+		return;
+	}
+	if (is_if(v)) {
+		compile_if(c, v, tail);
+		return;
+	}
+
+	for (i = 0; i < v->count; i++)
+		compile_expr(c, v->cell[i], 0);
+	emit(c, tail ? OP_TAILCALL : OP_CALL);
+	emit(c, v->count - 1);
+
+	/* only reached when the tail call could not reuse the frame */
+	if (tail)
+		emit(c, OP_RET);
+}
+
+static struct lcode *lcode_get(struct lval *v)
+{
+	if (!v->code) {
+		if (!sym_if)
+			sym_if = lsym_intern("if");
+		v->code = xcalloc(sizeof(struct lcode));
+		compile_list(v->code, v, 1);
+	}
+	return v->code;
+}
+
+void lcode_free(struct lcode *c)
+{
+	int i;
+	for (i = 0; i < c->nconsts; i++)
+		lval_free(c->consts[i]);
+	lcode_free_shallow(c);
+}
+
+/* free c but not the lvals it references */
+void lcode_free_shallow(struct lcode *c)
+{
+	lfree(c->consts, sizeof(struct lval *) * c->consts_cap);
+	lfree(c->ops, sizeof(int) * c->cap);
+	free(c);
+}
+
+void lcode_children(struct lcode *c, void (*fn)(struct lval *))
+{
+	int i;
+	for (i = 0; i < c->nconsts; i++)
+		fn(c->consts[i]);
+}
+
+static void push(struct lval *v)
+{
+	if (sp == stack_cap) {
+		stack_cap = stack_cap ? stack_cap * 2 : 64;
+		stack = realloc(stack, sizeof(struct lval *) * stack_cap);
+		if (!stack)
+			die("%s", "failed to allocate memory\n");
+	}
+	stack[sp++] = v;
+}
+
+static void push_frame(struct lcode *code, struct lenv *env,
+		       struct lval *owner)
+{
+	if (fp == frames_cap) {
+		frames_cap = frames_cap ? frames_cap * 2 : 16;
+		frames = realloc(frames, sizeof(struct lframe) * frames_cap);
+		if (!frames)
+			die("%s", "failed to allocate memory\n");
+	}
+	frames[fp].code = code;
+	frames[fp].pc = 0;
+	frames[fp].env = env;
+	frames[fp].owner = owner;
+	fp++;
+}
+
+/* A self tail call can take over the frame of the running function when
+ * the frame holds nothing but its formals: the callee binds the same names,
+ * so dropping the frame from the environment chain does not change what any
+ * lookup finds.
+ */
+static int can_reuse(struct lframe *fr, struct lval *f)
+{
+	return ltype(fr->owner) == LVAL_FUN &&
+	       fr->owner->env->scope == f->env->scope &&
+	       fr->owner->env->count == 0;
+}
+
+static void call(int n, int tail)
+{
+	struct lframe *fr = &frames[fp - 1];
+	struct lval *f = stack[sp - n - 1];
+	struct lval *a = lval_sexpr();
+
+	if (n) {
+		a->cell = lalloc(sizeof(struct lval *) * n);
+		memcpy(a->cell, &stack[sp - n], sizeof(struct lval *) * n);
+		a->count = n;
+		a->cap = n;
+	}
+	sp -= n + 1;
+
+	if (ltype(f) == LVAL_FUN_BUILTIN) {
+		/* may run nested lvm_eval(), fr is stale afterwards */
+		push(f->builtin(fr->env, a));
+		lval_free(f);
+		return;
+	}
+	if (ltype(f) != LVAL_FUN) {
+		push(lerr_args_type(fr->env, f, "eval_sexpr", LVAL_FUN,
+				    ltype(f)));
+		lval_free(f);
+		lval_free(a);
+		return;
+	}
+
+	struct lval *out = lval_bind(fr->env, f, a);
+	lval_free(f);
+	f = out;
+
+	/* error or partial */
+	if (ltype(f) != LVAL_FUN || f->formals) {
+		push(f);
+		return;
+	}
+
+	if (tail && can_reuse(fr, f)) {
+		f->env->par = fr->env->par;
+		lval_free(fr->owner);
+		fr->code = lcode_get(f->body);
+		fr->pc = 0;
+		fr->env = f->env;
+		fr->owner = f;
+		return;
+	}
+
+	/* set environment parent to evaluation environment */
+	f->env->par = fr->env;
+	push_frame(lcode_get(f->body), f->env, f);
+}
+
+/* run until the frame at index base returns */
+static struct lval *run(int base)
+{
+	struct lframe *fr;
+	struct lval *x, *c;
+	int *ops;
+
+	for (;;) {
+		fr = &frames[fp - 1];
+		ops = fr->code->ops;
+
+		switch (ops[fr->pc++]) {
+		case OP_CONST:
+			push(lval_ref(fr->code->consts[ops[fr->pc++]]));
+			break;
+		case OP_LOAD:
+			push(lenv_get(fr->env, fr->code->consts[ops[fr->pc++]]));
+			break;
+		case OP_EMPTY:
+			push(lval_sexpr());
+			break;
+		case OP_CALL:
+			call(ops[fr->pc++], 0);
+			break;
+		case OP_TAILCALL:
+			call(ops[fr->pc++], 1);
+			break;
+		case OP_IF:
+			x = stack[sp - 2];
+			c = stack[sp - 1];
+			if (ltype(x) == LVAL_FUN_BUILTIN &&
+			    x->builtin == builtin_if && ltype(c) == LVAL_NUM) {
+				fr->pc = lnum(c) ? fr->pc + 2 : ops[fr->pc];
+				sp -= 2;
+				lval_free(x);
+				lval_free(c);
+			} else {
+				fr->pc = ops[fr->pc + 1];
+			}
+			break;
+		case OP_JUMP:
+			fr->pc = ops[fr->pc];
+			break;
+		case OP_RET:
+			lval_free(fr->owner);
+			if (--fp == base)
+				return stack[--sp];
+			break;
+		}
+	}
+}
+
+/* evaluate the S-expression v in e, v is consumed */
+struct lval *lvm_eval(struct lenv *e, struct lval *v)
+{
+	int base = fp;
+	push_frame(lcode_get(v), e, v);
+	return run(base);
+}
+
+void lvm_cleanup(void)
+{
+	free(stack);
+	free(frames);
+	stack = NULL;
+	frames = NULL;
+	sp = stack_cap = fp = frames_cap = 0;
+}
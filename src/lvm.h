@@ -0,0 +1,16 @@
+#ifndef _LVM_H
+#define _LVM_H
+
+/* Bytecode compiler and stack VM
+ *
+ * An alternative to the tree walking evaluator in lisp.c, selected with
+ * `-e vm`. Lists are compiled on first evaluation and the code is cached on
+ * the list lval, see struct lcode in lvm.c.
+ */
+struct lval *lvm_eval(struct lenv *e, struct lval *v);
+void lcode_free(struct lcode *c);
+void lcode_free_shallow(struct lcode *c);
+void lcode_children(struct lcode *c, void (*fn)(struct lval *));
+void lvm_cleanup(void);
+
+#endif